@@ -0,0 +1,218 @@
+#include <string.h>
+#include "ansi.h"
+
+#define ANSI_ESC        '\033'
+#define ANSI_SGR_MAX    16
+
+enum {
+    ANSI_TEXT = 0,
+    ANSI_ESCAPE,                /* Seen ESC */
+    ANSI_INTERMEDIATE,          /* ESC followed by intermediate bytes */
+    ANSI_CSI,                   /* Inside ESC [ ... */
+    ANSI_OSC,                   /* Inside ESC ] ... */
+    ANSI_OSC_ESCAPE             /* Seen ESC inside an OSC string */
+};
+
+static guint32
+set_fg (guint32 style, guint idx)
+{
+    return (style & ~0x1ffu) | (idx + 1);
+}
+
+static guint32
+set_bg (guint32 style, guint idx)
+{
+    return (style & ~(0x1ffu << 9)) | ((idx + 1) << 9);
+}
+
+static guint
+rgb_to_index (gint r, gint g, gint b)
+{
+    /* Nearest entry of the 6x6x6 color cube */
+    return 16 + 36 * ((CLAMP (r, 0, 255) * 5 + 127) / 255)
+              +  6 * ((CLAMP (g, 0, 255) * 5 + 127) / 255)
+              +      ((CLAMP (b, 0, 255) * 5 + 127) / 255);
+}
+
+/**
+ * Parse an extended color (38/48) starting at codes[*i]. Returns the color
+ * index, or -1 if the parameters are malformed.
+ */
+static gint
+extended_color (const gint *codes, guint n, guint *i)
+{
+    if (*i + 2 < n && 5 == codes[*i + 1]) {
+        *i += 2;
+        return CLAMP (codes[*i], 0, 255);
+    }
+    if (*i + 4 < n && 2 == codes[*i + 1]) {
+        *i += 4;
+        return rgb_to_index (codes[*i - 2], codes[*i - 1], codes[*i]);
+    }
+    *i = n;
+    return -1;
+}
+
+static void
+apply_sgr (ansi_parser *parser)
+{
+    gint     codes[ANSI_SGR_MAX];
+    guint    n = 0,
+             i;
+    guint8   k;
+    gint     color;
+    guint32  style = parser->style;
+
+    /* Split the parameter bytes on ';' (and ':' sub-parameters) */
+    codes[0] = 0;
+    for (k = 0; k < parser->plen && n < ANSI_SGR_MAX; ++k) {
+        gchar c = parser->params[k];
+
+        if (c >= '0' && c <= '9') {
+            codes[n] = codes[n] * 10 + (c - '0');
+        } else if (';' == c || ':' == c) {
+            if (++n < ANSI_SGR_MAX) {
+                codes[n] = 0;
+            }
+        } else {
+            /* Private parameters: not an SGR sequence we understand */
+            return;
+        }
+    }
+    if (n < ANSI_SGR_MAX) {
+        ++n;
+    }
+
+    for (i = 0; i < n; ++i) {
+        gint code = codes[i];
+
+        if (code >= 30 && code <= 37) {
+            style = set_fg (style, code - 30);
+        } else if (code >= 40 && code <= 47) {
+            style = set_bg (style, code - 40);
+        } else if (code >= 90 && code <= 97) {
+            style = set_fg (style, code - 90 + 8);
+        } else if (code >= 100 && code <= 107) {
+            style = set_bg (style, code - 100 + 8);
+        } else switch (code)
+        {
+        case 0:  style  = ANSI_STYLE_DEFAULT; break;
+        case 1:  style |= ANSI_STYLE_BOLD; break;
+        case 2:  style |= ANSI_STYLE_FAINT; break;
+        case 3:  style |= ANSI_STYLE_ITALIC; break;
+        case 4:  style |= ANSI_STYLE_UNDERLINE; break;
+        case 7:  style |= ANSI_STYLE_INVERSE; break;
+        case 22: style &= ~(ANSI_STYLE_BOLD | ANSI_STYLE_FAINT); break;
+        case 23: style &= ~ANSI_STYLE_ITALIC; break;
+        case 24: style &= ~ANSI_STYLE_UNDERLINE; break;
+        case 27: style &= ~ANSI_STYLE_INVERSE; break;
+        case 39: style &= ~0x1ffu; break;
+        case 49: style &= ~(0x1ffu << 9); break;
+        case 38:
+            if ((color = extended_color (codes, n, &i)) >= 0) {
+                style = set_fg (style, color);
+            }
+            break;
+        case 48:
+            if ((color = extended_color (codes, n, &i)) >= 0) {
+                style = set_bg (style, color);
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    parser->style = style;
+}
+
+void
+ansi_parser_init (ansi_parser *parser)
+{
+    memset (parser, 0, sizeof (ansi_parser));
+}
+
+/**
+ * Feed a chunk of output through the parser. Escape sequences may be split
+ * across chunks; the parser picks up where the previous chunk left off.
+ *
+ * Plain text is located with memchr, which the C library vectorizes, so the
+ * cost for output without escapes stays close to that of a single scan.
+ */
+void
+ansi_parser_feed (ansi_parser     *parser,
+                  const gchar     *data,
+                  gsize            len,
+                  ansi_text_func   func,
+                  gpointer         user_data)
+{
+    const gchar *p   = data,
+                *end = data + len,
+                *esc;
+    gchar        c;
+
+    while (p < end) {
+        switch (parser->state)
+        {
+        case ANSI_TEXT:
+            esc = memchr (p, ANSI_ESC, end - p);
+            if (!esc) {
+                func (p, end - p, parser->style, user_data);
+                return;
+            }
+            if (esc > p) {
+                func (p, esc - p, parser->style, user_data);
+            }
+            p = esc + 1;
+            parser->state = ANSI_ESCAPE;
+            break;
+        case ANSI_ESCAPE:
+            c = *p++;
+            if ('[' == c) {
+                parser->plen  = 0;
+                parser->state = ANSI_CSI;
+            } else if (']' == c) {
+                parser->state = ANSI_OSC;
+            } else if (c >= 0x20 && c <= 0x2f) {
+                parser->state = ANSI_INTERMEDIATE;
+            } else {
+                /* Two-character sequence, ignored */
+                parser->state = ANSI_TEXT;
+            }
+            break;
+        case ANSI_INTERMEDIATE:
+            c = *p++;
+            if (c < 0x20 || c > 0x2f) {
+                parser->state = ANSI_TEXT;
+            }
+            break;
+        case ANSI_CSI:
+            c = *p++;
+            if (c >= 0x40 && c <= 0x7e) {
+                /* Final byte. Only SGR affects the output. */
+                if ('m' == c) {
+                    apply_sgr (parser);
+                }
+                parser->state = ANSI_TEXT;
+            } else if (parser->plen < ANSI_PARAM_MAX) {
+                parser->params[parser->plen++] = c;
+            }
+            break;
+        case ANSI_OSC:
+            c = *p++;
+            if ('\a' == c) {
+                parser->state = ANSI_TEXT;
+            } else if (ANSI_ESC == c) {
+                parser->state = ANSI_OSC_ESCAPE;
+            }
+            break;
+        case ANSI_OSC_ESCAPE:
+            c = *p++;
+            parser->state = ('\\' == c) ? ANSI_TEXT : ANSI_OSC;
+            break;
+        default:
+            parser->state = ANSI_TEXT;
+            break;
+        }
+    }
+}
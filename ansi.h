@@ -0,0 +1,47 @@
+#ifndef ANSI_H
+#define ANSI_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+#define ANSI_PARAM_MAX 32
+
+/* Text attributes packed into a single word, usable as a hash key:
+ *
+ *   bits  0-8   foreground (0 = default, otherwise 256-color index + 1)
+ *   bits  9-17  background (same encoding)
+ *   bits 18-    ANSI_STYLE_* flags
+ */
+#define ANSI_STYLE_DEFAULT    0
+#define ANSI_STYLE_FG(s)      ((s) & 0x1ff)
+#define ANSI_STYLE_BG(s)      (((s) >> 9) & 0x1ff)
+#define ANSI_STYLE_BOLD       (1 << 18)
+#define ANSI_STYLE_ITALIC     (1 << 19)
+#define ANSI_STYLE_UNDERLINE  (1 << 20)
+#define ANSI_STYLE_INVERSE    (1 << 21)
+#define ANSI_STYLE_FAINT      (1 << 22)
+
+typedef struct _ansi_parser ansi_parser;
+
+/* Receives maximal runs of printable text sharing one style */
+typedef void (*ansi_text_func) (const gchar *text,
+                                gsize        len,
+                                guint32      style,
+                                gpointer     user_data);
+
+struct _ansi_parser
+{
+    guint8   state;
+    guint8   plen;
+    gchar    params[ANSI_PARAM_MAX];  /* CSI parameter bytes seen so far */
+    guint32  style;
+};
+
+void ansi_parser_init (ansi_parser *parser);
+void ansi_parser_feed (ansi_parser *parser, const gchar *data, gsize len,
+                       ansi_text_func func, gpointer user_data);
+
+G_END_DECLS
+
+#endif /* ANSI_H */
@@ -0,0 +1,265 @@
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <glib/gstdio.h>
+#include "batch.h"
+#include "json.h"
+
+#define BATCH_IO_BUF_SIZE 65536
+
+typedef struct
+{
+    gchar   *text;
+    guint    index;
+    gint64   started;           /* When its output began to be expected */
+} batch_command;
+
+struct _batch
+{
+    GIOChannel  *script;        /* Commands, one per line */
+    gchar       *name;          /* Of the script, for errors */
+    guint        line;          /* Lines read so far */
+    FILE        *out;           /* Raw output or JSONL records */
+    gboolean     jsonl;
+    GString     *command;       /* Command being read */
+    GQueue       sent;          /* Commands awaiting their prompt, oldest
+                                 * first; the output is the head's */
+    gint64       first;         /* Start of the first command */
+    guint        count,         /* Commands sent */
+                 done;          /* Commands completed */
+};
+
+static void
+batch_command_free (batch_command *c)
+{
+    g_free (c->text);
+    g_free (c);
+}
+
+/**
+ * Open a batch run. Commands are read from script ("-" for stdin) one line
+ * at a time, so arbitrarily long scripts can be streamed in. Output goes to
+ * stdout, or as one JSON object per command to jsonl if given.
+ */
+batch *
+batch_new (const gchar  *script,
+           const gchar  *jsonl,
+           GError      **error)
+{
+    batch      *b;
+    GIOChannel *channel;
+    FILE       *out = stdout;
+
+    if (!g_strcmp0 (script, "-")) {
+        channel = g_io_channel_unix_new (fileno (stdin));
+    } else {
+        channel = g_io_channel_new_file (script, "r", error);
+        if (!channel) {
+            return NULL;
+        }
+    }
+    /* Read bytes, and check them here: a UTF-8 channel would stop at the
+     * first invalid one as if the script had ended */
+    g_io_channel_set_encoding (channel, NULL, NULL);
+
+    if (jsonl) {
+        out = g_fopen (jsonl, "w");
+        if (!out) {
+            g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+                         "%s: %s", jsonl, g_strerror (errno));
+            g_io_channel_unref (channel);
+            return NULL;
+        }
+        setvbuf (out, NULL, _IOFBF, BATCH_IO_BUF_SIZE);
+    }
+
+    b          = g_malloc0 (sizeof (batch));
+    b->script  = channel;
+    b->name    = g_strdup (g_strcmp0 (script, "-") ? script : "stdin");
+    b->out     = out;
+    b->jsonl   = NULL != jsonl;
+    b->command = g_string_new (NULL);
+    g_queue_init (&b->sent);
+
+    return b;
+}
+
+/**
+ * The head of the queue is next to produce output: open its record.
+ */
+static void
+begin_record (batch *b)
+{
+    batch_command *c = g_queue_peek_head (&b->sent);
+
+    /* Sent ahead, it only starts once the command before it is done */
+    c->started = g_get_monotonic_time ();
+    if (!c->index) {
+        b->first = c->started;
+    }
+
+    if (b->jsonl) {
+        fprintf (b->out, "{\"index\":%u,\"input\":\"", c->index);
+        json_write_string (b->out, (const guint8 *) c->text,
+                           strlen (c->text) - 1);
+        fputs ("\",\"output\":\"", b->out);
+    }
+}
+
+/**
+ * Read the next command from the script and queue it to await its prompt.
+ * A :{ ... :} block is returned as a single command. Returns NULL when the
+ * script is exhausted, or on error: a read error, or a line that is not
+ * valid UTF-8.
+ */
+const gchar *
+batch_next (batch   *b,
+            GError **error)
+{
+    batch_command *c;
+    gchar         *line;
+    gsize          len;
+    gboolean       block = FALSE;
+    GIOStatus      status;
+
+    g_string_truncate (b->command, 0);
+
+    while (G_IO_STATUS_NORMAL == (status = g_io_channel_read_line (
+                                               b->script, &line, &len, NULL,
+                                               error))) {
+        ++b->line;
+        if (!g_utf8_validate (line, len, NULL)) {
+            g_set_error (error, G_CONVERT_ERROR,
+                         G_CONVERT_ERROR_ILLEGAL_SEQUENCE,
+                         "%s:%u: not valid UTF-8", b->name, b->line);
+            g_free (line);
+            return NULL;
+        }
+        g_strchomp (line);
+
+        if (!block && (!*line || g_str_has_prefix (line, "--"))) {
+            /* Skip blank lines and comments */
+            g_free (line);
+            continue;
+        }
+
+        g_string_append (b->command, line);
+        g_string_append_c (b->command, '\n');
+
+        if (!strcmp (line, ":{")) {
+            block = TRUE;
+        } else if (!strcmp (line, ":}")) {
+            block = FALSE;
+        }
+        g_free (line);
+
+        if (!block) {
+            break;
+        }
+    }
+
+    if (G_IO_STATUS_ERROR == status) {
+        g_prefix_error (error, "%s:%u: ", b->name, b->line + 1);
+        return NULL;
+    }
+    if (!b->command->len) {
+        return NULL;
+    }
+
+    c        = g_malloc0 (sizeof (batch_command));
+    c->text  = g_strdup (b->command->str);
+    c->index = b->count++;
+    g_queue_push_tail (&b->sent, c);
+
+    if (1 == g_queue_get_length (&b->sent)) {
+        begin_record (b);
+    }
+    return c->text;
+}
+
+/**
+ * Whether any command sent is still waiting for its prompt.
+ */
+gboolean
+batch_pending (batch *b)
+{
+    return !g_queue_is_empty (&b->sent);
+}
+
+guint
+batch_in_flight (batch *b)
+{
+    return g_queue_get_length (&b->sent);
+}
+
+/**
+ * Stream a chunk of the oldest pending command's output. Output that does
+ * not belong to a command (the ghci banner) is dropped.
+ */
+void
+batch_output (batch         *b,
+              const guint8  *data,
+              gsize          bytes)
+{
+    if (g_queue_is_empty (&b->sent)) {
+        return;
+    }
+
+    if (b->jsonl) {
+        json_write_string (b->out, data, bytes);
+    } else {
+        fwrite (data, 1, bytes, b->out);
+    }
+}
+
+/**
+ * A prompt was reached: it ends the oldest pending command, whose record
+ * is finished, and the output that follows is the next one's.
+ */
+void
+batch_complete (batch *b)
+{
+    batch_command *c = g_queue_pop_head (&b->sent);
+    gdouble        ms;
+
+    if (!c) {
+        return;
+    }
+
+    ms = (g_get_monotonic_time () - c->started) / 1000.0;
+
+    if (b->jsonl) {
+        fprintf (b->out, "\",\"ms\":%.3f}\n", ms);
+    } else {
+        fflush (b->out);
+    }
+
+    batch_command_free (c);
+    ++b->done;
+
+    if (!g_queue_is_empty (&b->sent)) {
+        begin_record (b);
+    }
+}
+
+void
+batch_free (batch *b)
+{
+    gdouble ms = b->done ? (g_get_monotonic_time () - b->first) / 1000.0
+                         : 0;
+
+    g_message ("Batch: %u commands in %.1f ms (%.3f ms/command)",
+               b->done, ms, b->done ? ms / b->done : 0);
+
+    if (b->out != stdout) {
+        fclose (b->out);
+    } else {
+        fflush (b->out);
+    }
+    g_io_channel_unref (b->script);
+    g_queue_foreach (&b->sent, (GFunc) batch_command_free, NULL);
+    g_queue_clear (&b->sent);
+    g_string_free (b->command, TRUE);
+    g_free (b->name);
+    g_free (b);
+}
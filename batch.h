@@ -0,0 +1,23 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+#define BATCH_PIPELINE_MAX  64  /* Commands sent ahead of their prompts */
+
+typedef struct _batch batch;
+
+batch        *batch_new       (const gchar *script, const gchar *jsonl,
+                               GError **error);
+const gchar  *batch_next      (batch *b, GError **error);
+gboolean      batch_pending   (batch *b);
+guint         batch_in_flight (batch *b);
+void          batch_output    (batch *b, const guint8 *data, gsize bytes);
+void          batch_complete  (batch *b);
+void          batch_free      (batch *b);
+
+G_END_DECLS
+
+#endif /* BATCH_H */
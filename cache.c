@@ -0,0 +1,601 @@
+#include <string.h>
+#include "cache.h"
+#include "trace.h"
+
+typedef struct
+{
+    gchar      *key;
+    GBytes     *value;
+    gchar      *type;           /* Of it, as the command bound it */
+    GList       link;           /* In the LRU queue, most recent first */
+} cache_entry;
+
+struct _result_cache
+{
+    GHashTable *entries;        /* Key -> cache_entry */
+    GQueue      lru;
+    gsize       bytes,
+                max_bytes;
+
+    guint       generation;     /* Bumped by commands that change state */
+    gchar      *fingerprint;    /* Of the last :show bindings/imports */
+    GString    *session;        /* Bootstrap output being collected */
+
+    gchar      *expr,           /* Normalized command awaiting its result */
+               *key;
+    GString    *result,
+               *type;
+    gboolean    failed;         /* Result unusable (stderr, too large) */
+
+    guint       hits,
+                misses,
+                stores,
+                evictions;
+};
+
+/* ghci commands that only look at the session */
+static const gchar *read_only_commands[] = {
+    ":type", ":kind", ":info", ":browse", ":show", ":doc", ":help", ":?",
+    NULL
+};
+
+/* Declarations and statements that add to the session */
+static const gchar *binding_keywords[] = {
+    "let", "import", "data", "type", "newtype", "class", "instance",
+    "foreign", "deriving", "default", "infix", "infixl", "infixr", "pattern",
+    NULL
+};
+
+static gboolean
+is_symbol (gchar c)
+{
+    return c && NULL != strchr ("!#$%&*+./<=>?@\\^|-~:", c);
+}
+
+static gboolean
+is_ident (gchar c)
+{
+    return g_ascii_isalnum (c) || '_' == c || '\'' == c;
+}
+
+/**
+ * Collapse whitespace outside of string literals. Sets *binds if the input
+ * looks like a binding (x <- e, f x = e) rather than an expression.
+ */
+static gchar *
+normalize (const gchar  *input,
+           gboolean     *binds)
+{
+    GString     *s      = g_string_sized_new (strlen (input));
+    const gchar *p;
+    gboolean     string = FALSE,
+                 space  = FALSE;
+    gint         depth  = 0;
+    gchar        prev;
+
+    *binds = FALSE;
+
+    for (p = input; *p; ++p) {
+        if (string) {
+            g_string_append_c (s, *p);
+            if ('\\' == *p && p[1]) {
+                g_string_append_c (s, *++p);
+            } else if ('"' == *p) {
+                string = FALSE;
+            }
+            continue;
+        }
+
+        if (g_ascii_isspace (*p)) {
+            space = TRUE;
+            continue;
+        }
+        if (space && s->len) {
+            g_string_append_c (s, ' ');
+        }
+        space = FALSE;
+        prev  = s->len ? s->str[s->len - 1] : 0;
+
+        switch (*p)
+        {
+        case '"':
+            string = TRUE;
+            break;
+        case '(': case '[': case '{':
+            ++depth;
+            break;
+        case ')': case ']': case '}':
+            --depth;
+            break;
+        case '<':
+            /* Generators in comprehensions and do blocks are fine */
+            if (!depth && '-' == p[1] && !is_symbol (prev)
+                    && !is_symbol (p[2])) {
+                *binds = TRUE;
+            }
+            break;
+        case '=':
+            if (!depth && !is_symbol (prev) && !is_symbol (p[1])) {
+                *binds = TRUE;
+            }
+            break;
+        default:
+            break;
+        }
+        g_string_append_c (s, *p);
+    }
+
+    return g_string_free (s, FALSE);
+}
+
+/**
+ * Whether a normalized expression refers to it, the result of the last
+ * evaluation, which is not part of the session fingerprint.
+ */
+static gboolean
+mentions_it (const gchar *expr)
+{
+    const gchar *p;
+    gboolean     string = FALSE;
+
+    for (p = expr; *p; ++p) {
+        if (string) {
+            if ('\\' == *p && p[1]) {
+                ++p;
+            } else if ('"' == *p) {
+                string = FALSE;
+            }
+        } else if ('"' == *p) {
+            string = TRUE;
+        } else if ('i' == p[0] && 't' == p[1] && !is_ident (p[2])
+                   && (p == expr || !is_ident (p[-1]))) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+static gboolean
+is_command (const gchar *word,
+            gsize        len,
+            const gchar *command)
+{
+    /* ghci accepts any unambiguous prefix */
+    return len >= 2 && len <= strlen (command)
+        && !strncmp (word, command, len);
+}
+
+static gboolean
+changes_state (const gchar *expr)
+{
+    gsize len = strcspn (expr, " ");
+    guint i;
+
+    if (':' == *expr) {
+        for (i = 0; read_only_commands[i]; ++i) {
+            if (is_command (expr, len, read_only_commands[i])) {
+                return FALSE;
+            }
+        }
+        return TRUE;
+    }
+
+    for (i = 0; binding_keywords[i]; ++i) {
+        if (len == strlen (binding_keywords[i])
+                && !strncmp (expr, binding_keywords[i], len)) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+static gsize
+entry_size (cache_entry *e)
+{
+    return g_bytes_get_size (e->value) + strlen (e->key) + strlen (e->type);
+}
+
+static void
+entry_free (cache_entry *e)
+{
+    g_free (e->key);
+    g_bytes_unref (e->value);
+    g_free (e->type);
+    g_free (e);
+}
+
+static void
+entry_remove (result_cache *c,
+              cache_entry  *e)
+{
+    g_queue_unlink (&c->lru, &e->link);
+    c->bytes -= entry_size (e);
+    g_hash_table_remove (c->entries, e->key);
+}
+
+static void
+store (result_cache *c,
+       gchar        *key,
+       GBytes       *value,
+       gchar        *type)
+{
+    cache_entry *e = g_hash_table_lookup (c->entries, key);
+
+    if (e) {
+        entry_remove (c, e);
+    }
+
+    e             = g_malloc0 (sizeof (cache_entry));
+    e->key        = key;
+    e->value      = value;
+    e->type       = type;
+    e->link.data  = e;
+
+    g_hash_table_insert (c->entries, e->key, e);
+    g_queue_push_head_link (&c->lru, &e->link);
+    c->bytes += entry_size (e);
+    ++c->stores;
+
+    while (c->bytes > c->max_bytes) {
+        entry_remove (c, g_queue_peek_tail (&c->lru));
+        ++c->evictions;
+    }
+
+    TRACE_COUNTER ("result_cache.bytes", c->bytes);
+}
+
+static void
+pending_clear (result_cache *c)
+{
+    g_clear_pointer (&c->expr, g_free);
+    g_clear_pointer (&c->key, g_free);
+    g_string_truncate (c->result, 0);
+    g_string_truncate (c->type, 0);
+    c->failed = FALSE;
+}
+
+/**
+ * Whether a :type answer describes a value whose evaluation has no
+ * effects: not an IO action, nor an action in a monad that ghci would
+ * default to IO.
+ */
+static gboolean
+is_pure_type (const gchar *answer)
+{
+    const gchar *p,
+                *t = NULL;
+    gint         depth = 0;
+
+    /* The answer echoes the expression, which may carry annotations of its
+     * own, so the type follows the last top-level :: */
+    for (p = answer; *p; ++p) {
+        if ('(' == *p || '[' == *p) {
+            ++depth;
+        } else if (')' == *p || ']' == *p) {
+            --depth;
+        } else if (!depth && ':' == p[0] && ':' == p[1]) {
+            t = p + 2;
+        }
+    }
+    if (!t) {
+        return FALSE;
+    }
+
+    /* Skip the context */
+    for (p = t, depth = 0; *p; ++p) {
+        if ('(' == *p) {
+            ++depth;
+        } else if (')' == *p) {
+            --depth;
+        } else if (!depth && '=' == p[0] && '>' == p[1]) {
+            t = p + 2;
+        }
+    }
+
+    while (g_ascii_isspace (*t)) {
+        ++t;
+    }
+
+    if (g_str_has_prefix (t, "IO") && !is_ident (t[2])) {
+        return FALSE;
+    }
+    if (g_ascii_islower (*t)) {
+        /* A type variable applied to something, m a */
+        for (p = t; is_ident (*p); ++p) {
+        }
+        while (' ' == *p) {
+            ++p;
+        }
+        return !*p || '\n' == *p || '-' == *p;
+    }
+    return TRUE;
+}
+
+/**
+ * The type of it in the answer to :show bindings, "it :: T = v", with the
+ * line breaks of a long type collapsed; NULL if it is not bound. ghci has
+ * fixed the type when it bound it, which the expression alone need not.
+ */
+static gchar *
+it_type (const gchar *bindings)
+{
+    GString     *type;
+    const gchar *p,
+                *q = NULL;
+
+    for (p = bindings; ; ++p) {
+        if ('i' == p[0] && 't' == p[1] && g_ascii_isspace (p[2])) {
+            q = p + 2 + strspn (p + 2, " \t\r\n");
+            if (g_str_has_prefix (q, ":: ")) {
+                break;
+            }
+        }
+        p = strchr (p, '\n');
+        if (!p) {
+            return NULL;
+        }
+    }
+
+    type = g_string_new (NULL);
+    for (p = q + 3; *p; ) {
+        if (!g_ascii_isspace (*p)) {
+            g_string_append_c (type, *p++);
+            continue;
+        }
+        for (; g_ascii_isspace (*p); ++p) {
+            if ('\n' == *p && p[1] && !g_ascii_isspace (p[1])) {
+                /* The next binding; a value never shown */
+                p = "";
+                break;
+            }
+        }
+        if ('=' == p[0] && (!p[1] || g_ascii_isspace (p[1]))) {
+            break;
+        }
+        if (*p && type->len) {
+            g_string_append_c (type, ' ');
+        }
+    }
+
+    if (!type->len) {
+        g_string_free (type, TRUE);
+        return NULL;
+    }
+    return g_string_free (type, FALSE);
+}
+
+/**
+ * Whether a type can be written back as it stands: without a context,
+ * which would generalise it, and without qualified names, which ghci uses
+ * for types that are not in scope.
+ */
+static gboolean
+is_writable_type (const gchar *type)
+{
+    const gchar *p;
+
+    if (strstr (type, "=>")) {
+        return FALSE;
+    }
+    for (p = type; *p; ++p) {
+        if (g_ascii_isupper (*p) && (p == type || !is_ident (p[-1]))) {
+            while (is_ident (*p)) {
+                ++p;
+            }
+            if ('.' == *p && is_ident (p[1])) {
+                return FALSE;
+            }
+        }
+        if (!*p) {
+            break;
+        }
+    }
+    return TRUE;
+}
+
+/**
+ * Opt-in cache of evaluation results. Output is replayed for an expression
+ * submitted again in the same session state: the same loaded modules,
+ * bindings and imports, as reported by the bootstrap queries that follow
+ * every command.
+ */
+result_cache *
+result_cache_new (gsize max_bytes)
+{
+    result_cache *c = g_malloc0 (sizeof (result_cache));
+
+    c->entries   = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+                                          (GDestroyNotify) entry_free);
+    c->max_bytes = max_bytes;
+    c->session   = g_string_new (NULL);
+    c->result    = g_string_new (NULL);
+    c->type      = g_string_new (NULL);
+
+    return c;
+}
+
+/**
+ * Called for every command sent by the user. Returns the output to show
+ * instead of running the command, if the result is known. ghci has not
+ * rebound it then: rebind is set to the command that does, binding it to
+ * the expression at the type the original evaluation gave it. Otherwise
+ * the command's output is collected for the cache, if it might be pure
+ * and the session is idle (idle is FALSE while another command is
+ * running).
+ */
+GBytes *
+result_cache_submit (result_cache  *c,
+                     const gchar   *input,
+                     gboolean       idle,
+                     gchar        **rebind)
+{
+    cache_entry *e;
+    gchar       *expr;
+    const gchar *nl;
+    gboolean     binds;
+
+    pending_clear (c);
+
+    expr = normalize (input, &binds);
+
+    if (binds || changes_state (expr)) {
+        /* :load, :reload, let, x <- e, f x = e, ... */
+        ++c->generation;
+        g_free (expr);
+        return NULL;
+    }
+
+    nl = strchr (input, '\n');
+    if (!*expr || ':' == *expr || (nl && nl[strspn (nl, "\r\n\t ")])
+            || !idle || !c->fingerprint || mentions_it (expr)) {
+        /* Multi-line input is layout sensitive; leave it alone. The value
+         * of it is not in the fingerprint, so neither is its result. */
+        g_free (expr);
+        return NULL;
+    }
+
+    c->key = g_strdup_printf ("%u\n%s\n%s", c->generation, c->fingerprint,
+                              expr);
+
+    e = g_hash_table_lookup (c->entries, c->key);
+    if (e) {
+        g_queue_unlink (&c->lru, &e->link);
+        g_queue_push_head_link (&c->lru, &e->link);
+        ++c->hits;
+
+        *rebind = g_strdup_printf ("let it = (%s) :: %s", expr, e->type);
+        g_free (expr);
+        g_clear_pointer (&c->key, g_free);
+        return g_bytes_ref (e->value);
+    }
+
+    ++c->misses;
+    c->expr = expr;
+
+    return NULL;
+}
+
+/**
+ * Output of the command passed to the last result_cache_submit ().
+ */
+void
+result_cache_output (result_cache *c,
+                     pio_stream    stream,
+                     const guint8 *data,
+                     gsize         len)
+{
+    if (!c->expr || c->failed) {
+        return;
+    }
+
+    /* Errors and warnings are not results; neither are huge ones */
+    if (PIO_STREAM_OUT != stream
+            || c->result->len + len > c->max_bytes / 4) {
+        c->failed = TRUE;
+        g_string_truncate (c->result, 0);
+        return;
+    }
+    g_string_append_len (c->result, (const gchar *) data, len);
+}
+
+/**
+ * Output of the :show bindings and :show imports queries.
+ */
+void
+result_cache_session (result_cache *c,
+                      const guint8 *data,
+                      gsize         len)
+{
+    g_string_append_len (c->session, (const gchar *) data, len);
+}
+
+/**
+ * The expression whose type decides whether the pending result is stored,
+ * or NULL if there is nothing to store.
+ */
+const gchar *
+result_cache_type_query (result_cache *c)
+{
+    return c->expr && !c->failed ? c->expr : NULL;
+}
+
+void
+result_cache_type (result_cache *c,
+                   const guint8 *data,
+                   gsize         len)
+{
+    g_string_append_len (c->type, (const gchar *) data, len);
+}
+
+/**
+ * The queries following a command are done: store its result if it was
+ * pure, and take the fingerprint of the session state.
+ */
+void
+result_cache_complete (result_cache *c)
+{
+    gchar   **lines,
+             *type;
+    guint     i;
+    gboolean  it;
+    GString  *state;
+
+    /* Only results that it can be bound to again, at the same type */
+    type = c->expr && !c->failed ? it_type (c->session->str) : NULL;
+    if (type && is_pure_type (c->type->str) && is_writable_type (type)) {
+        store (c, g_steal_pointer (&c->key),
+               g_bytes_new (c->result->str, c->result->len),
+               g_steal_pointer (&type));
+    }
+    g_free (type);
+    pending_clear (c);
+
+    /* Every evaluation rebinds it; that alone changes nothing. A long
+     * type puts the binding on several lines, the rest indented. */
+    state = g_string_new (NULL);
+    lines = g_strsplit (c->session->str, "\n", -1);
+    for (i = 0, it = FALSE; lines[i]; ++i) {
+        if (!g_ascii_isspace (lines[i][0])) {
+            it = !strcmp (lines[i], "it") || g_str_has_prefix (lines[i], "it ");
+        }
+        if (!it && lines[i][0]) {
+            g_string_append (state, lines[i]);
+            g_string_append_c (state, '\n');
+        }
+    }
+    g_strfreev (lines);
+
+    g_free (c->fingerprint);
+    c->fingerprint = g_compute_checksum_for_string (G_CHECKSUM_SHA1,
+                                                    state->str, state->len);
+    g_string_free (state, TRUE);
+    g_string_truncate (c->session, 0);
+}
+
+/**
+ * Forget everything cached for the session so far, as when it has been
+ * replaced.
+ */
+void
+result_cache_invalidate (result_cache *c)
+{
+    ++c->generation;
+    pending_clear (c);
+}
+
+void
+result_cache_free (result_cache *c)
+{
+    g_message ("Result cache: %u hits, %u misses, %u stored, %u evicted, "
+               "%" G_GSIZE_FORMAT " bytes held", c->hits, c->misses,
+               c->stores, c->evictions, c->bytes);
+
+    g_hash_table_destroy (c->entries);
+    g_string_free (c->session, TRUE);
+    g_string_free (c->result, TRUE);
+    g_string_free (c->type, TRUE);
+    g_free (c->expr);
+    g_free (c->key);
+    g_free (c->fingerprint);
+    g_free (c);
+}
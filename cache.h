@@ -0,0 +1,26 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "processio.h"
+
+G_BEGIN_DECLS
+
+typedef struct _result_cache result_cache;
+
+result_cache *result_cache_new        (gsize max_bytes);
+GBytes       *result_cache_submit     (result_cache *c, const gchar *input,
+                                       gboolean idle, gchar **rebind);
+void          result_cache_output     (result_cache *c, pio_stream stream,
+                                       const guint8 *data, gsize len);
+void          result_cache_session    (result_cache *c, const guint8 *data,
+                                       gsize len);
+const gchar  *result_cache_type_query (result_cache *c);
+void          result_cache_type       (result_cache *c, const guint8 *data,
+                                       gsize len);
+void          result_cache_complete   (result_cache *c);
+void          result_cache_invalidate (result_cache *c);
+void          result_cache_free       (result_cache *c);
+
+G_END_DECLS
+
+#endif /* CACHE_H */
@@ -1,11 +1,13 @@
 #include <string.h>
 #include "commandentry.h"
+#include "trace.h"
 
 struct _CommandEntryPrivate
 {
     GList       *history,
                 *commands;
     GSequence   *wordbank;
+    word_index  *names;         /* Shared completion index, or NULL */
     GCompareDataFunc cmp_func;
     gint         index,
                  count;
@@ -25,6 +27,21 @@ do_append (gchar *str, GList **list)
     *list = g_list_append (*list, g_strdup (str));
 }
 
+/**
+ * Rebuild the list walked with Up and Down from the history.
+ */
+static void
+reset_commands (CommandEntryPrivate *priv)
+{
+    /* Deep copy the history list to priv->commands */
+    g_list_free_full (priv->commands, (GDestroyNotify) g_free);
+    priv->commands = NULL;
+    g_list_foreach (priv->history, (GFunc) do_append, &priv->commands);
+    priv->index = 0;
+    priv->commands = g_list_prepend (priv->commands, NULL);
+    priv->count = g_list_length (priv->commands);
+}
+
 static void
 update_entry_text (GtkEntry *entry, const gchar *text)
 {
@@ -62,11 +79,17 @@ static GList *
 auto_complete (CommandEntry *self, gchar *cmd)
 {
     CommandEntryPrivate *priv = self->priv;
-    GList               *str_list;
+    GList               *str_list = NULL;
     GSequenceIter       *begin_iter,
                         *end_iter;
     gchar               *dup;
     size_t               len;
+    guint                first,
+                         last;
+
+    if (!*cmd) {
+        return NULL;
+    }
 
     begin_iter = g_sequence_lookup (priv->wordbank, cmd, priv->cmp_func, NULL);
     if (!begin_iter) {
@@ -80,14 +103,30 @@ auto_complete (CommandEntry *self, gchar *cmd)
     end_iter = g_sequence_search (priv->wordbank, dup, priv->cmp_func, NULL);
     g_free (dup);
 
-    if (begin_iter == end_iter) {
-        return NULL;
+    if (begin_iter != end_iter) {
+        str_list = g_list_alloc ();
+        g_sequence_foreach_range (begin_iter, end_iter,
+                                  (GFunc) list_append,
+                                  &str_list);
+    }
+
+    /* Names from the index are looked up in the mapped file itself */
+    if (priv->names && word_index_range (priv->names, cmd, &first, &last)) {
+        last = MIN (last, first + COMMAND_ENTRY_INDEX_MATCHES);
+
+        if (!str_list) {
+            str_list = g_list_alloc ();
+        }
+        for (; first < last; ++first) {
+            const gchar *name = word_index_get (priv->names, first);
+
+            if (!g_sequence_lookup (priv->wordbank, (gpointer) name,
+                                    priv->cmp_func, NULL)) {
+                str_list = g_list_prepend (str_list, g_strdup (name));
+            }
+        }
     }
 
-    str_list = g_list_alloc ();
-    g_sequence_foreach_range (begin_iter, end_iter,
-                              (GFunc) list_append,
-                              &str_list);
     return str_list;
 }
 
@@ -162,9 +201,8 @@ on_tab (CommandEntry *entry)
 }
 
 static gboolean
-on_key_pressed (GtkEntry                  *entry,
-                GdkEventKey               *event,
-                gpointer    G_GNUC_UNUSED  data)
+handle_key (GtkEntry    *entry,
+            GdkEventKey *event)
 {
     CommandEntry *self = COMMAND_ENTRY (entry);
     CommandEntryPrivate *priv = self->priv;
@@ -179,14 +217,7 @@ on_key_pressed (GtkEntry                  *entry,
             return TRUE;
         }
         priv->history = g_list_prepend (priv->history, g_strdup (str));
-
-        /* Deep copy the history list to priv->commands */
-        g_list_free_full (priv->commands, (GDestroyNotify) g_free);
-        priv->commands = NULL;
-        g_list_foreach (priv->history, (GFunc) do_append, &priv->commands);
-        priv->index = 0;
-        priv->commands = g_list_prepend (priv->commands, NULL);
-        priv->count++;
+        reset_commands (priv);
         g_signal_emit_by_name (entry, "enter-press");
 
         /* Clear the text input */
@@ -214,6 +245,21 @@ on_key_pressed (GtkEntry                  *entry,
     return FALSE;
 }
 
+static gboolean
+on_key_pressed (GtkEntry                  *entry,
+                GdkEventKey               *event,
+                gpointer    G_GNUC_UNUSED  data)
+{
+    gboolean ret;
+
+    TRACE_BEGIN ("command_entry.key");
+    TRACE_INSTANT ("command_entry.keyval", event->keyval);
+    ret = handle_key (entry, event);
+    TRACE_END ("command_entry.key");
+
+    return ret;
+}
+
 /**
  * Class initialization: Used to add properties, hook finalization functions,
  * add the private structure to the class and initialize the parent class
@@ -281,6 +327,7 @@ command_entry_init (CommandEntry *self)
     priv->history  = NULL;
     priv->commands = NULL;
     priv->wordbank = g_sequence_new (g_free);
+    priv->names    = NULL;
     priv->cmp_func = (GCompareDataFunc) g_strcmp0;
     priv->index    = 0;
     priv->count    = 1;
@@ -302,10 +349,14 @@ command_entry_dispose (GObject *object)
     if (priv->wordbank) {
         g_sequence_free (priv->wordbank);
     }
+    if (priv->names) {
+        word_index_free (priv->names);
+    }
 
     priv->commands = NULL;
     priv->history  = NULL;
     priv->wordbank = NULL;
+    priv->names    = NULL;
     priv->cmp_func = NULL;
 
     G_OBJECT_CLASS (command_entry_parent_class)->dispose (object);
@@ -350,3 +401,49 @@ command_entry_remove_word (CommandEntry *self, gchar *word)
         g_sequence_remove (iter);
     }
 }
+
+/**
+ * Complete from a word_index as well as from the word bank. The entry takes
+ * ownership of the index.
+ */
+void
+command_entry_set_index (CommandEntry *self, word_index *index)
+{
+    CommandEntryPrivate *priv = COMMAND_ENTRY_GET_PRIVATE (self);
+
+    if (!priv->wordbank) {
+        /* Already disposed */
+        word_index_free (index);
+        return;
+    }
+    if (priv->names) {
+        word_index_free (priv->names);
+    }
+    priv->names = index;
+}
+
+/**
+ * Add commands from earlier sessions, oldest first, behind those entered
+ * since the entry was created.
+ */
+void
+command_entry_set_history (CommandEntry *self, gchar **commands)
+{
+    CommandEntryPrivate *priv = COMMAND_ENTRY_GET_PRIVATE (self);
+    GList               *older = NULL;
+
+    if (!priv->wordbank) {
+        /* Already disposed */
+        return;
+    }
+
+    for (; *commands; ++commands) {
+        older = g_list_prepend (older, g_strdup (*commands));
+    }
+    priv->history = g_list_concat (priv->history, older);
+
+    if (!priv->index) {
+        /* Not while the user is browsing it */
+        reset_commands (priv);
+    }
+}
@@ -2,9 +2,12 @@
 #define COMMANDENTRY_H
 
 #include <gtk/gtk.h>
+#include "wordindex.h"
 
 G_BEGIN_DECLS
 
+#define COMMAND_ENTRY_INDEX_MATCHES 1000   /* Index names offered at once */
+
 #define TYPE_COMMAND_ENTRY             (command_entry_get_type ())
 #define COMMAND_ENTRY(obj)             (G_TYPE_CHECK_INSTANCE_CAST ((obj), TYPE_COMMAND_ENTRY, CommandEntry))
 #define COMMAND_ENTRY_CLASS(klass)     (G_TYPE_CHECK_CLASS_CAST ((klass), TYPE_COMMAND_ENTRY, CommandEntryClass))
@@ -45,6 +48,8 @@ GType       command_entry_get_type     (void) G_GNUC_CONST;
 GtkWidget  *command_entry_new          (void);
 void        command_entry_insert_word  (CommandEntry *self, gchar *word);
 void        command_entry_remove_word  (CommandEntry *self, gchar *word);
+void        command_entry_set_index    (CommandEntry *self, word_index *index);
+void        command_entry_set_history  (CommandEntry *self, gchar **commands);
 
 G_END_DECLS
 
@@ -0,0 +1,606 @@
+#define _GNU_SOURCE
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <glib-unix.h>
+#include "daemon.h"
+#include "processio.h"
+
+typedef struct _session session;
+typedef struct _client client;
+typedef struct _command command;
+
+/* A hosted ghci. A private session serves the one client it was handed
+ * to; a shared one serves every client that asked for it by name, running
+ * their commands one at a time. */
+struct _session
+{
+    pio_env     *ghci;          /* NULL once ghci has exited */
+    gchar       *name;          /* Shared under this name, or NULL */
+    GList       *clients;       /* Empty while the session is the spare */
+    GQueue       backlog;       /* Output from before a client attached, as
+                                 * GBytes led by the stream byte */
+    GQueue       commands;      /* Shared: commands waiting their turn */
+    command     *running;       /* Shared: the one ghci is busy with */
+    guint8       tail[TAIL_SIZE];
+    guint        tlen;          /* Last bytes of its stdout, for the prompt
+                                 * that ends the running command */
+};
+
+struct _client
+{
+    pio_env     *env;
+    session     *session;       /* NULL until the first frame names one */
+    GString     *input;         /* Shared: a command not yet complete */
+    gboolean     in_block;      /* ... within :{ and :} */
+};
+
+struct _command
+{
+    client      *client;        /* NULL once the client has gone */
+    GBytes      *text;
+};
+
+static gchar     **_argv     = NULL;
+static session    *_spare    = NULL;   /* Started ahead of the next client */
+static GList      *_sessions = NULL;
+static GMainLoop  *_loop     = NULL;
+
+static void
+command_free (command *cmd)
+{
+    g_bytes_unref (cmd->text);
+    g_free (cmd);
+}
+
+static void
+session_free (session *s)
+{
+    g_queue_foreach (&s->backlog, (GFunc) g_bytes_unref, NULL);
+    g_queue_clear (&s->backlog);
+    g_queue_foreach (&s->commands, (GFunc) command_free, NULL);
+    g_queue_clear (&s->commands);
+    if (s->running) {
+        command_free (s->running);
+    }
+
+    _sessions = g_list_remove (_sessions, s);
+    g_free (s->name);
+    g_free (s);
+
+    g_message ("Session closed (%u left)", g_list_length (_sessions));
+}
+
+/**
+ * Give ghci the next command in line, once it is done with the last.
+ */
+static void
+command_next (session *s)
+{
+    gconstpointer  text;
+    gsize          size;
+
+    if (s->running || !s->ghci) {
+        return;
+    }
+
+    s->running = g_queue_pop_head (&s->commands);
+    if (s->running) {
+        s->tlen = 0;
+        text    = g_bytes_get_data (s->running->text, &size);
+        processio_write (s->ghci, text, size);
+    }
+}
+
+/**
+ * Drop the commands of c that have not started yet.
+ */
+static void
+command_drop (session *s,
+              client  *c)
+{
+    GList   *l,
+            *next;
+    command *cmd;
+
+    for (l = s->commands.head; l; l = next) {
+        next = l->next;
+        cmd  = l->data;
+        if (cmd->client == c) {
+            command_free (cmd);
+            g_queue_delete_link (&s->commands, l);
+        }
+    }
+}
+
+/**
+ * Queue the complete commands in input from c to a shared session: single
+ * lines, each answered with a prompt, and :{ :} blocks.
+ */
+static void
+command_input (session      *s,
+               client       *c,
+               const guint8 *data,
+               gsize         len)
+{
+    command     *cmd;
+    const gchar *line,
+                *nl;
+    gsize        start = 0;
+
+    g_string_append_len (c->input, (const gchar *) data, len);
+
+    while ((nl = memchr (c->input->str + start, '\n',
+                         c->input->len - start))) {
+        line        = c->input->str + start;
+        c->in_block = c->in_block ? !g_str_has_prefix (line, ":}")
+                                  : g_str_has_prefix (line, ":{");
+        start       = nl - c->input->str + 1;
+
+        if (!c->in_block) {
+            cmd         = g_malloc (sizeof (command));
+            cmd->client = c;
+            cmd->text   = g_bytes_new (c->input->str, start);
+            g_queue_push_tail (&s->commands, cmd);
+
+            g_string_erase (c->input, 0, start);
+            start = 0;
+        }
+    }
+
+    command_next (s);
+}
+
+/**
+ * Keep the last bytes of stdout, where a prompt may have begun.
+ */
+static void
+tail_push (session      *s,
+           const guint8 *data,
+           gsize         len)
+{
+    gsize keep;
+
+    if (len >= TAIL_SIZE - 1) {
+        memcpy (s->tail, data + len - (TAIL_SIZE - 1), TAIL_SIZE - 1);
+        s->tlen = TAIL_SIZE - 1;
+        return;
+    }
+
+    keep = MIN (s->tlen, TAIL_SIZE - 1 - len);
+    memmove (s->tail, s->tail + s->tlen - keep, keep);
+    memcpy (s->tail + keep, data, len);
+    s->tlen = keep + len;
+}
+
+/**
+ * Pass output on to whoever it is for: the client whose command is
+ * running, or every client of the session.
+ */
+static void
+deliver (session      *s,
+         pio_stream    stream,
+         const guint8 *data,
+         gsize         len)
+{
+    guint8 *chunk;
+    GList  *l;
+
+    if (s->running) {
+        if (s->running->client) {
+            processio_send (s->running->client->env, stream, data, len);
+        }
+        return;
+    }
+
+    for (l = s->clients; l; l = l->next) {
+        processio_send (((client *) l->data)->env, stream, data, len);
+    }
+    if (s->clients) {
+        return;
+    }
+
+    chunk    = g_malloc (len + 1);
+    chunk[0] = stream;
+    memcpy (chunk + 1, data, len);
+    g_queue_push_tail (&s->backlog, g_bytes_new_take (chunk, len + 1));
+}
+
+static void
+on_ghci_output (pio_stream   stream,
+                guint8      *data,
+                gsize        bytes,
+                session     *s)
+{
+    gsize n;
+
+    while (bytes) {
+        /* A shared session's command ends at its prompt */
+        n = s->running && PIO_STREAM_OUT == stream
+          ? processio_prompt_end (s->tail, s->tlen, data, bytes) : 0;
+
+        if (n) {
+            deliver (s, stream, data, n);
+            command_free (s->running);
+            s->running = NULL;
+            command_next (s);
+        } else {
+            n = bytes;
+            deliver (s, stream, data, n);
+            if (PIO_STREAM_OUT == stream) {
+                tail_push (s, data, n);
+            }
+        }
+
+        data  += n;
+        bytes -= n;
+    }
+}
+
+static void
+on_ghci_exit (pio_env G_GNUC_UNUSED *env,
+              session               *s)
+{
+    GList *clients,
+          *l;
+
+    s->ghci = NULL;
+
+    if (s == _spare) {
+        g_warning ("Spare ghci exited before it was used");
+        _spare = NULL;
+    }
+
+    if (!s->clients) {
+        session_free (s);
+        return;
+    }
+
+    /* Hang up; the last client's exit releases the session */
+    clients = g_list_copy (s->clients);
+    for (l = clients; l; l = l->next) {
+        processio_kill (((client *) l->data)->env);
+    }
+    g_list_free (clients);
+}
+
+static session *
+session_find (const gchar *name)
+{
+    GList   *l;
+    session *s;
+
+    for (l = _sessions; l; l = l->next) {
+        s = l->data;
+        if (s->name && s->ghci && !strcmp (s->name, name)) {
+            return s;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Launch a ghci that is not yet attached to a client. Its startup, and
+ * the banner and first prompt, happen while nobody is waiting on them.
+ */
+static session *
+session_new (void)
+{
+    session *s   = g_malloc0 (sizeof (session));
+    pio_env *env = processio_env_new (NULL);
+
+    if (!processio_init (_argv, &env, (pio_read_func) on_ghci_output, s)) {
+        processio_env_free (env);
+        g_free (s);
+        return NULL;
+    }
+    env->exit_func = (pio_exit_func) on_ghci_exit;
+    env->exit_data = s;
+
+    s->ghci   = env;
+    _sessions = g_list_prepend (_sessions, s);
+
+    return s;
+}
+
+/**
+ * Attach c to the session shared under name, or to a session of its own if
+ * name is NULL or nobody shares it yet. The warm spare is used for a new
+ * session, and the next one is launched in the background.
+ */
+static void
+session_attach (client *c,
+                gchar  *name)
+{
+    session *s = name ? session_find (name) : NULL;
+    GBytes  *chunk;
+    gsize    size;
+
+    if (s) {
+        s->clients = g_list_append (s->clients, c);
+        c->session = s;
+        g_free (name);
+
+        /* ghci is long past its first prompt; the client bootstraps off
+         * this one, and its queries take their turn as commands */
+        processio_send (c->env, PIO_STREAM_OUT,
+                        (const guint8 *) TAIL_STRING, TAIL_SIZE);
+
+        g_message ("Client joined session %s (%u attached)", s->name,
+                   g_list_length (s->clients));
+        return;
+    }
+
+    s      = _spare ? _spare : session_new ();
+    _spare = NULL;
+
+    if (!s) {
+        g_free (name);
+        processio_kill (c->env);
+        return;
+    }
+
+    s->name    = name;
+    s->clients = g_list_append (s->clients, c);
+    c->session = s;
+
+    while ((chunk = g_queue_pop_head (&s->backlog))) {
+        const guint8 *bytes = g_bytes_get_data (chunk, &size);
+
+        processio_send (c->env, bytes[0], bytes + 1, size - 1);
+        g_bytes_unref (chunk);
+    }
+
+    if (name) {
+        g_message ("Session %s attached (%u running)", name,
+                   g_list_length (_sessions));
+    } else {
+        g_message ("Session attached (%u running)",
+                   g_list_length (_sessions));
+    }
+
+    _spare = session_new ();
+}
+
+static void
+on_client_frame (pio_stream   type,
+                 guint8      *data,
+                 gsize        len,
+                 client      *c)
+{
+    session *s = c->session;
+
+    if (!s) {
+        if (PIO_FRAME_SESSION != type) {
+            g_warning ("Client did not name a session");
+            processio_kill (c->env);
+            return;
+        }
+        session_attach (c, len ? g_strndup ((const gchar *) data, len)
+                               : NULL);
+        return;
+    }
+
+    if (!s->ghci) {
+        return;
+    }
+
+    switch (type)
+    {
+    case PIO_STREAM_IN:
+        if (s->name) {
+            command_input (s, c, data, len);
+        } else {
+            processio_write (s->ghci, (const gchar *) data, len);
+        }
+        break;
+    case PIO_FRAME_INTERRUPT:
+        /* In a shared session, only the client's own commands */
+        command_drop (s, c);
+        if (!s->name || (s->running && s->running->client == c)) {
+            processio_interrupt (s->ghci);
+        }
+        break;
+    default:
+        g_warning ("Unexpected frame type %d from client", type);
+        break;
+    }
+}
+
+static void
+on_client_exit (pio_env G_GNUC_UNUSED *env,
+                client                *c)
+{
+    session *s = c->session;
+
+    g_string_free (c->input, TRUE);
+    g_free (c);
+
+    if (!s) {
+        return;
+    }
+
+    command_drop (s, c);
+    if (s->running && s->running->client == c) {
+        /* Its output goes nowhere until the prompt */
+        s->running->client = NULL;
+    }
+    s->clients = g_list_remove (s->clients, c);
+
+    if (s->clients) {
+        g_message ("Client left session %s (%u attached)", s->name,
+                   g_list_length (s->clients));
+    } else if (s->ghci) {
+        processio_kill (s->ghci);
+    } else {
+        session_free (s);
+    }
+}
+
+static gboolean
+on_accept (GIOChannel              *channel,
+           GIOCondition G_GNUC_UNUSED cond,
+           gpointer     G_GNUC_UNUSED data)
+{
+    client *c;
+    gint    fd;
+
+    fd = accept4 (g_io_channel_unix_get_fd (channel), NULL, NULL,
+                  SOCK_CLOEXEC);
+    if (fd < 0) {
+        if (EAGAIN != errno && EINTR != errno) {
+            g_warning ("accept: %s", g_strerror (errno));
+        }
+        return TRUE;
+    }
+
+    /* The session is picked once the client's first frame names it */
+    c        = g_malloc0 (sizeof (client));
+    c->env   = processio_env_new (NULL);
+    c->input = g_string_new (NULL);
+
+    processio_socket_init (fd, &c->env, (pio_read_func) on_client_frame, c);
+    c->env->exit_func = (pio_exit_func) on_client_exit;
+    c->env->exit_data = c;
+
+    return TRUE;
+}
+
+static gboolean
+on_quit (gpointer G_GNUC_UNUSED data)
+{
+    g_main_loop_quit (_loop);
+    return G_SOURCE_REMOVE;
+}
+
+static gint
+listen_on (const gchar  *path,
+           GError      **error)
+{
+    struct sockaddr_un addr;
+    gint               fd;
+    mode_t             mask;
+    gboolean           bound;
+
+    memset (&addr, 0, sizeof (addr));
+    addr.sun_family = AF_UNIX;
+
+    if (strlen (path) >= sizeof (addr.sun_path)) {
+        g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_NAMETOOLONG,
+                     "%s: Socket path too long", path);
+        return -1;
+    }
+    strcpy (addr.sun_path, path);
+
+    /* Refuse to take over the socket of a running daemon */
+    fd = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        goto fail;
+    }
+    if (!connect (fd, (struct sockaddr *) &addr, sizeof (addr))) {
+        g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_EXIST,
+                     "%s: A daemon is already listening", path);
+        close (fd);
+        return -1;
+    }
+    close (fd);
+
+    /* Nobody is listening: clear out a stale socket file */
+    unlink (path);
+
+    fd = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (fd < 0) {
+        goto fail;
+    }
+
+    /* Sessions run arbitrary code; keep the socket to ourselves */
+    mask  = umask (S_IRWXG | S_IRWXO | S_IXUSR);
+    bound = !bind (fd, (struct sockaddr *) &addr, sizeof (addr));
+    umask (mask);
+
+    if (!bound || listen (fd, SOMAXCONN)) {
+        goto fail;
+    }
+
+    return fd;
+
+fail:
+    g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+                 "%s: %s", path, g_strerror (errno));
+    if (fd >= 0) {
+        close (fd);
+    }
+    return -1;
+}
+
+/**
+ * Serve ghci sessions to clients connecting to the Unix socket at path
+ * (gtk-ghci --connect) until SIGINT or SIGTERM.
+ *
+ * A client that names a session (--share) gets the ghci shared under that
+ * name, started for the first client to name it. Every window working on
+ * the same project can so use a single ghci, and the project is loaded
+ * and held in memory once. The windows share its bindings and loaded
+ * modules too, and their commands take turns: each goes to ghci once the
+ * prompt of the previous one is in, and its output goes back to the
+ * window that sent it. A program that reads stdin does not get input from
+ * a shared session, as each line is taken for a command.
+ *
+ * Other clients get a ghci of their own. One is kept running as the
+ * spare, so a new window gets a ghci already at its prompt; the spare
+ * also serves as the first ghci of a new shared session. A ghci that has
+ * loaded anything cannot be forked (the GHC runtime is multi-threaded),
+ * so there is no warm template to clone; sharing is what saves memory.
+ */
+gboolean
+daemon_run (const gchar  *path,
+            gchar       **argv,
+            GError      **error)
+{
+    GIOChannel *channel;
+    guint       watch;
+    gint        fd;
+    GList      *l;
+
+    fd = listen_on (path, error);
+    if (fd < 0) {
+        return FALSE;
+    }
+
+    /* A client going away shows up as a failed write, not a signal */
+    signal (SIGPIPE, SIG_IGN);
+
+    _argv  = argv;
+    _loop  = g_main_loop_new (NULL, FALSE);
+    _spare = session_new ();
+
+    channel = g_io_channel_unix_new (fd);
+    watch   = g_io_add_watch (channel, G_IO_IN, on_accept, NULL);
+
+    g_unix_signal_add (SIGINT, on_quit, NULL);
+    g_unix_signal_add (SIGTERM, on_quit, NULL);
+
+    g_message ("Listening on %s", path);
+    g_main_loop_run (_loop);
+
+    g_source_remove (watch);
+    g_io_channel_shutdown (channel, FALSE, NULL);
+    g_io_channel_unref (channel);
+    unlink (path);
+
+    for (l = _sessions; l; l = l->next) {
+        session *s = l->data;
+
+        if (s->ghci) {
+            processio_kill (s->ghci);
+        }
+    }
+
+    g_main_loop_unref (_loop);
+
+    return TRUE;
+}
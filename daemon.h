@@ -0,0 +1,12 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+gboolean daemon_run (const gchar *path, gchar **argv, GError **error);
+
+G_END_DECLS
+
+#endif /* DAEMON_H */
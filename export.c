@@ -0,0 +1,146 @@
+#include <stdio.h>
+#include <errno.h>
+#include <glib/gstdio.h>
+#include "export.h"
+#include "json.h"
+#include "trace.h"
+
+#define EXPORT_IO_BUF_SIZE 65536
+
+typedef struct
+{
+    transcript    *t;
+    gchar         *path;
+    export_format  format;
+} export_job;
+
+static void
+export_job_free (export_job *job)
+{
+    transcript_unref (job->t);
+    g_free (job->path);
+    g_free (job);
+}
+
+static void
+write_range (FILE        *out,
+             transcript  *t,
+             guint64      from,
+             guint64      to,
+             gboolean     json)
+{
+    const guint8 *data;
+    gsize         n;
+
+    /* One chunk at a time, straight from the store */
+    while ((n = transcript_peek (t, from, to, &data))) {
+        if (json) {
+            json_write_string (out, data, n);
+        } else {
+            fwrite (data, 1, n, out);
+        }
+        from += n;
+    }
+}
+
+static void
+write_commands (FILE        *out,
+                transcript  *t,
+                guint64      length)
+{
+    transcript_command cmd;
+    guint              i;
+
+    for (i = 0; transcript_get_command (t, i, &cmd); ++i) {
+        if (cmd.input >= length) {
+            break;
+        }
+
+        fprintf (out, "{\"index\":%u,\"input\":\"", i);
+        /* Leave out the newline ending the echoed input */
+        write_range (out, t, cmd.input, MAX (cmd.output, cmd.input + 1) - 1,
+                     TRUE);
+        fputs ("\",\"output\":\"", out);
+        write_range (out, t, cmd.output, MIN (cmd.end, length), TRUE);
+
+        if (cmd.finished) {
+            fprintf (out, "\",\"ms\":%.3f}\n",
+                     (cmd.finished - cmd.started) / 1000.0);
+        } else {
+            fputs ("\",\"ms\":null}\n", out);
+        }
+    }
+}
+
+static void
+export_thread (GTask                      *task,
+               gpointer     G_GNUC_UNUSED  source,
+               export_job                 *job,
+               GCancellable G_GNUC_UNUSED *cancellable)
+{
+    FILE    *out;
+    guint64  length;
+
+    TRACE_BEGIN ("export");
+
+    out = g_fopen (job->path, "w");
+    if (!out) {
+        g_task_return_new_error (task, G_FILE_ERROR,
+                                 g_file_error_from_errno (errno),
+                                 "%s: %s", job->path, g_strerror (errno));
+        TRACE_END ("export");
+        return;
+    }
+    setvbuf (out, NULL, _IOFBF, EXPORT_IO_BUF_SIZE);
+
+    /* Output appended after this point is not part of the export */
+    length = transcript_get_length (job->t);
+
+    if (EXPORT_JSONL == job->format) {
+        write_commands (out, job->t, length);
+    } else {
+        write_range (out, job->t, 0, length, FALSE);
+    }
+
+    if (ferror (out) | fclose (out)) {
+        g_task_return_new_error (task, G_FILE_ERROR,
+                                 g_file_error_from_errno (errno),
+                                 "%s: %s", job->path, g_strerror (errno));
+    } else {
+        g_task_return_boolean (task, TRUE);
+    }
+
+    TRACE_END ("export");
+}
+
+/**
+ * Write the transcript to path on a worker thread. The text is streamed
+ * from the chunk store through a fixed-size buffer, so memory use does not
+ * depend on the size of the transcript.
+ */
+void
+export_async (transcript          *t,
+              const gchar         *path,
+              export_format        format,
+              GAsyncReadyCallback  callback,
+              gpointer             data)
+{
+    GTask      *task;
+    export_job *job = g_malloc0 (sizeof (export_job));
+
+    job->t      = transcript_ref (t);
+    job->path   = g_strdup (path);
+    job->format = format;
+
+    task = g_task_new (NULL, NULL, callback, data);
+    g_task_set_task_data (task, job, (GDestroyNotify) export_job_free);
+    g_task_run_in_thread (task, (GTaskThreadFunc) export_thread);
+    g_object_unref (task);
+}
+
+gboolean
+export_finish (GAsyncResult  *result,
+               GError       **error)
+{
+    return g_task_propagate_boolean (G_TASK (result), error);
+}
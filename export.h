@@ -0,0 +1,21 @@
+#ifndef EXPORT_H
+#define EXPORT_H
+
+#include <gio/gio.h>
+#include "transcript.h"
+
+G_BEGIN_DECLS
+
+typedef enum {
+    EXPORT_TEXT = 0,            /* The transcript as plain text */
+    EXPORT_JSONL                /* One JSON object per command */
+} export_format;
+
+void     export_async  (transcript *t, const gchar *path,
+                        export_format format, GAsyncReadyCallback callback,
+                        gpointer data);
+gboolean export_finish (GAsyncResult *result, GError **error);
+
+G_END_DECLS
+
+#endif /* EXPORT_H */
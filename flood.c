@@ -0,0 +1,266 @@
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
+#include "flood.h"
+#include "trace.h"
+
+struct _flood
+{
+    gdouble     rate;           /* Bytes per second, weighted average */
+    gint64      stamp;          /* When rate was last updated */
+    gboolean    spilling,
+                failed;         /* Spill file unusable until the next one */
+
+    gint        fd;             /* Spill file of the current command */
+    gchar      *path;
+    GPtrArray  *paths;          /* Every spill file, removed on exit */
+    guint64     spilled,        /* Bytes written to path */
+                dropped;        /* Bytes past FLOOD_SPILL_MAX, not kept */
+
+    GByteArray *pending,        /* Not yet written */
+               *tail;           /* Last output, for display */
+};
+
+/**
+ * Watch the rate of output, and once it is more than the view can keep up
+ * with, write it to a spill file instead, up to FLOOD_SPILL_MAX bytes of it
+ * per command.
+ */
+flood *
+flood_new (void)
+{
+    flood *f = g_malloc0 (sizeof (flood));
+
+    f->fd      = -1;
+    f->stamp   = g_get_monotonic_time ();
+    f->paths   = g_ptr_array_new_with_free_func (g_free);
+    f->pending = g_byte_array_sized_new (FLOOD_WRITE_SIZE);
+    f->tail    = g_byte_array_sized_new (2 * FLOOD_TAIL_BYTES);
+
+    return f;
+}
+
+/**
+ * The rate decayed to time now, with len more bytes arriving. A first-order
+ * average: at a steady rate R it settles on R, and it halves in about
+ * FLOOD_WINDOW_MS once output stops.
+ */
+static gdouble
+rate_at (flood   *f,
+         gint64   now,
+         gsize    len)
+{
+    gdouble window = FLOOD_WINDOW_MS * 1000.0,
+            dt     = MAX (now - f->stamp, 0);
+
+    return (f->rate * window + len * (gdouble) G_USEC_PER_SEC)
+         / (window + dt);
+}
+
+static void
+spill_write (flood *f)
+{
+    const guint8 *p   = f->pending->data;
+    gsize         len = f->pending->len;
+    gssize        n;
+
+    while (len && !f->failed) {
+        n = write (f->fd, p, len);
+        if (n < 0) {
+            if (EINTR == errno) {
+                continue;
+            }
+            g_warning ("%s: %s", f->path, g_strerror (errno));
+            f->failed   = TRUE;
+            f->spilling = FALSE;
+            break;
+        }
+        p   += n;
+        len -= n;
+    }
+    g_byte_array_set_size (f->pending, 0);
+}
+
+/**
+ * Open a spill file for the current command, under the user's cache
+ * directory: /tmp is often held in memory, which is what spilling is meant
+ * to spare.
+ */
+static gboolean
+spill_open (flood *f)
+{
+    gchar *dir;
+
+    if (f->fd >= 0) {
+        return TRUE;
+    }
+
+    dir = g_build_filename (g_get_user_cache_dir (), "gtk-ghci", "spill",
+                            NULL);
+    g_mkdir_with_parents (dir, 0700);
+
+    g_free (f->path);
+    f->path = g_build_filename (dir, "gtk-ghci-XXXXXX.out", NULL);
+    f->fd   = g_mkstemp (f->path);
+    g_free (dir);
+
+    if (f->fd < 0) {
+        g_warning ("%s: %s", f->path, g_strerror (errno));
+        f->failed = TRUE;
+        return FALSE;
+    }
+    g_ptr_array_add (f->paths, g_strdup (f->path));
+    f->spilled = 0;
+    f->dropped = 0;
+
+    return TRUE;
+}
+
+/**
+ * Account for output. Returns TRUE if it went to the spill file, in which
+ * case the caller must not show it.
+ */
+gboolean
+flood_feed (flood        *f,
+            const guint8 *data,
+            gsize         len)
+{
+    gint64 now = g_get_monotonic_time ();
+
+    f->rate  = rate_at (f, now, len);
+    f->stamp = now;
+
+    if (!f->spilling && !f->failed && f->rate > FLOOD_ENTER_RATE) {
+        if (!spill_open (f)) {
+            return FALSE;
+        }
+        f->spilling = TRUE;
+        g_byte_array_set_size (f->tail, 0);
+        TRACE_INSTANT ("flood.enter", (gint64) f->rate);
+    } else if (f->spilling && f->rate < FLOOD_LEAVE_RATE) {
+        /* Back to a pace the view can follow */
+        spill_write (f);
+        f->spilling = FALSE;
+        TRACE_INSTANT ("flood.leave", (gint64) f->rate);
+    }
+
+    if (!f->spilling) {
+        return FALSE;
+    }
+
+    if (f->spilled + len > FLOOD_SPILL_MAX) {
+        /* Enough to go on; only the tail is kept from here */
+        f->dropped += len;
+        TRACE_COUNTER ("flood.dropped", f->dropped);
+    } else {
+        g_byte_array_append (f->pending, data, len);
+        if (f->pending->len >= FLOOD_WRITE_SIZE) {
+            spill_write (f);
+        }
+        f->spilled += len;
+        TRACE_COUNTER ("flood.spilled", f->spilled);
+    }
+
+    if (len >= FLOOD_TAIL_BYTES) {
+        g_byte_array_set_size (f->tail, 0);
+        g_byte_array_append (f->tail, data + len - FLOOD_TAIL_BYTES,
+                             FLOOD_TAIL_BYTES);
+    } else {
+        if (f->tail->len + len > 2 * FLOOD_TAIL_BYTES) {
+            g_byte_array_remove_range (f->tail, 0,
+                                       f->tail->len + len - FLOOD_TAIL_BYTES);
+        }
+        g_byte_array_append (f->tail, data, len);
+    }
+
+    return TRUE;
+}
+
+/**
+ * Output rate in bytes per second, as of now.
+ */
+gdouble
+flood_rate (flood *f)
+{
+    return rate_at (f, g_get_monotonic_time (), 0);
+}
+
+/**
+ * Bytes written to the spill file of the current or last command.
+ */
+guint64
+flood_spilled (flood *f)
+{
+    return f->spilled;
+}
+
+/**
+ * Bytes of the current or last command's output that came after the spill
+ * file reached FLOOD_SPILL_MAX, and were discarded.
+ */
+guint64
+flood_dropped (flood *f)
+{
+    return f->dropped;
+}
+
+const gchar *
+flood_path (flood *f)
+{
+    return f->path;
+}
+
+/**
+ * At most the last FLOOD_TAIL_BYTES of output spilled since the flood
+ * began, raw.
+ */
+const guint8 *
+flood_tail (flood *f,
+            gsize *len)
+{
+    gsize skip = f->tail->len - MIN (f->tail->len, FLOOD_TAIL_BYTES);
+
+    *len = f->tail->len - skip;
+    return f->tail->data + skip;
+}
+
+/**
+ * The command has ended: close its spill file. Returns TRUE if any of its
+ * output went there.
+ */
+gboolean
+flood_finish (flood *f)
+{
+    f->failed = FALSE;
+    if (f->fd < 0) {
+        return FALSE;
+    }
+
+    spill_write (f);
+    if (close (f->fd)) {
+        g_warning ("%s: %s", f->path, g_strerror (errno));
+    }
+    f->fd       = -1;
+    f->spilling = FALSE;
+
+    return f->spilled > 0;
+}
+
+void
+flood_free (flood *f)
+{
+    guint i;
+
+    flood_finish (f);
+
+    for (i = 0; i < f->paths->len; ++i) {
+        g_unlink (g_ptr_array_index (f->paths, i));
+    }
+
+    g_ptr_array_free (f->paths, TRUE);
+    g_byte_array_free (f->pending, TRUE);
+    g_byte_array_free (f->tail, TRUE);
+    g_free (f->path);
+    g_free (f);
+}
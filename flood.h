@@ -0,0 +1,34 @@
+#ifndef FLOOD_H
+#define FLOOD_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Output faster than FLOOD_ENTER_RATE bytes per second goes to a spill file
+ * instead of the view, until the rate falls below FLOOD_LEAVE_RATE. The rate
+ * is an exponentially weighted average over FLOOD_WINDOW_MS. */
+#define FLOOD_ENTER_RATE    (4 * 1024 * 1024)
+#define FLOOD_LEAVE_RATE    (256 * 1024)
+#define FLOOD_WINDOW_MS     250
+#define FLOOD_WRITE_SIZE    (1024 * 1024)   /* Spill file write size */
+#define FLOOD_SPILL_MAX     (256 * 1024 * 1024) /* Per command, then dropped */
+#define FLOOD_TAIL_BYTES    (8 * 1024)      /* Last output kept for display */
+#define FLOOD_TAIL_LINES    8               /* Of it, shown while spilling */
+#define FLOOD_REFRESH_MS    100
+
+typedef struct _flood flood;
+
+flood        *flood_new      (void);
+gboolean      flood_feed     (flood *f, const guint8 *data, gsize len);
+gdouble       flood_rate     (flood *f);
+guint64       flood_spilled  (flood *f);
+guint64       flood_dropped  (flood *f);
+const gchar  *flood_path     (flood *f);
+const guint8 *flood_tail     (flood *f, gsize *len);
+gboolean      flood_finish   (flood *f);
+void          flood_free     (flood *f);
+
+G_END_DECLS
+
+#endif /* FLOOD_H */
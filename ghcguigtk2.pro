@@ -6,7 +6,25 @@ CONFIG -= qt
 SOURCES += main.c \
     processio.c \
     ui.c \
-    commandentry.c
+    commandentry.c \
+    trace.c \
+    record.c \
+    batch.c \
+    ansi.c \
+    outview.c \
+    transcript.c \
+    search.c \
+    json.c \
+    export.c \
+    daemon.c \
+    reload.c \
+    cache.c \
+    wordindex.c \
+    history.c \
+    startup.c \
+    flood.c \
+    utf8.c \
+    hint.c
 
 INCLUDEPATH += /usr/include/gtk-3.0
 INCLUDEPATH += /usr/include/glib-2.0
@@ -14,8 +32,29 @@ INCLUDEPATH += /usr/include/glib-2.0
 CONFIG += link_pkgconfig
 PKGCONFIG += gtk+-3.0
 
+# Uncomment to compile in the tracepoints (dump with SIGUSR1 or F12)
+#DEFINES += ENABLE_TRACE
+
 HEADERS += \
     processio.h \
     ui.h \
-    commandentry.h
+    commandentry.h \
+    trace.h \
+    record.h \
+    batch.h \
+    ansi.h \
+    outview.h \
+    transcript.h \
+    search.h \
+    json.h \
+    export.h \
+    daemon.h \
+    reload.h \
+    cache.h \
+    wordindex.h \
+    history.h \
+    startup.h \
+    flood.h \
+    utf8.h \
+    hint.h
 
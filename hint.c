@@ -0,0 +1,370 @@
+#include <string.h>
+#include "hint.h"
+#include "trace.h"
+
+struct _hinter
+{
+    pio_env     *env;           /* The worker, NULL once it has exited */
+    GHashTable  *cache;         /* Expression -> type, "" if it has none */
+    GString     *out;           /* Worker stdout since the query was sent */
+    gchar       *marker,        /* Prompt bracketing the current answer */
+                *inflight,      /* Expression being checked, or NULL */
+                *wanted;        /* Expression last asked about */
+    guint        serial,
+                 debounce;
+    gboolean     opened,        /* The first marker has been seen */
+                 cancelled;     /* The worker was interrupted */
+    gint64       sent;
+    hint_func    func;
+    gpointer     data;
+};
+
+/* Input that is not an expression, or whose type the worker must not see
+ * before the main session has run it */
+static const gchar *skip_keywords[] = {
+    "let", "import", "data", "type", "newtype", "class", "instance",
+    "deriving", "foreign", "default", NULL
+};
+
+/* Input that shapes the session, replayed to the worker */
+static const gchar *track_prefixes[] = {
+    ":add ", ":module ", ":m ", ":set ", ":cd ",
+    "import ", "let ", "data ", "type ", "newtype ", "class ", "instance ",
+    NULL
+};
+
+/* Commands replayed whatever their arguments, or with none: a bare :load
+ * unloads everything */
+static const gchar *track_commands[] = {
+    ":load", ":l", ":reload", ":r", NULL
+};
+
+static gboolean
+first_word_is (const gchar  *text,
+               const gchar **words)
+{
+    gsize len = strcspn (text, " \t");
+    guint i;
+
+    for (i = 0; words[i]; ++i) {
+        if (len == strlen (words[i]) && !strncmp (text, words[i], len)) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/**
+ * The type in an answer to :type, with line breaks and indentation that
+ * ghci adds to long types collapsed; NULL if the answer is not a type.
+ */
+static gchar *
+parse_answer (const gchar *expr,
+              const gchar *answer)
+{
+    GString     *type;
+    const gchar *p;
+    gboolean     space = FALSE;
+
+    /* ghci echoes the expression as given */
+    while (g_ascii_isspace (*answer)) {
+        ++answer;
+    }
+    if (!g_str_has_prefix (answer, expr)
+            || !g_str_has_prefix (answer + strlen (expr), " :: ")) {
+        return NULL;
+    }
+
+    type = g_string_new (NULL);
+    for (p = answer + strlen (expr) + 4; *p; ++p) {
+        if (g_ascii_isspace (*p)) {
+            space = TRUE;
+            continue;
+        }
+        if (space && type->len) {
+            g_string_append_c (type, ' ');
+        }
+        space = FALSE;
+        g_string_append_c (type, *p);
+    }
+    return g_string_free (type, FALSE);
+}
+
+/**
+ * Ask the worker for the type of h->wanted. Each query gets a prompt of its
+ * own, so that the answer is the text between the first two of them, and
+ * anything else the worker prints is told apart from it.
+ */
+static void
+send_query (hinter *h)
+{
+    gchar *cmd;
+
+    g_free (h->inflight);
+    g_free (h->marker);
+
+    h->inflight  = g_strdup (h->wanted);
+    h->marker    = g_strdup_printf ("\n#%u>", ++h->serial);
+    h->opened    = FALSE;
+    h->cancelled = FALSE;
+    h->sent      = g_get_monotonic_time ();
+    g_string_truncate (h->out, 0);
+
+    cmd = g_strdup_printf (":set prompt \"\\n#%u>\"\n:type %s\n", h->serial,
+                           h->inflight);
+    processio_write (h->env, cmd, -1);
+    g_free (cmd);
+
+    TRACE_INSTANT ("hint.query", h->serial);
+}
+
+static void
+answer_done (hinter      *h,
+             const gchar *answer)
+{
+    gchar *expr = g_steal_pointer (&h->inflight),
+          *type = NULL;
+
+    if (!h->cancelled) {
+        type = parse_answer (expr, answer);
+
+        if (g_hash_table_size (h->cache) >= HINT_CACHE_MAX) {
+            g_hash_table_remove_all (h->cache);
+        }
+        g_hash_table_replace (h->cache, g_strdup (expr),
+                              g_strdup (type ? type : ""));
+
+        TRACE_COUNTER ("hint.us", g_get_monotonic_time () - h->sent);
+    }
+
+    if (h->wanted && !strcmp (expr, h->wanted)) {
+        h->func (h, expr, type, h->data);
+    } else if (h->wanted && !h->debounce
+               && !g_hash_table_contains (h->cache, h->wanted)) {
+        /* Asked for something else meanwhile */
+        send_query (h);
+    }
+
+    g_free (type);
+    g_free (expr);
+}
+
+static void
+on_worker_read (pio_stream   stream,
+                guint8      *data,
+                gsize        bytes,
+                hinter      *h)
+{
+    const gchar *m;
+    gsize        mlen;
+    gchar       *answer;
+
+    if (!bytes || PIO_STREAM_OUT != stream) {
+        /* Type errors, and the notice of an interrupt, go to stderr */
+        return;
+    }
+
+    if (!h->inflight) {
+        /* Output of a replayed command */
+        return;
+    }
+
+    g_string_append_len (h->out, (const gchar *) data, bytes);
+    mlen = strlen (h->marker);
+
+    if (!h->opened) {
+        m = strstr (h->out->str, h->marker);
+        if (!m) {
+            /* Keep what may be the start of the marker */
+            if (h->out->len >= mlen) {
+                g_string_erase (h->out, 0, h->out->len - mlen + 1);
+            }
+            return;
+        }
+        g_string_erase (h->out, 0, m - h->out->str + mlen);
+        h->opened = TRUE;
+    }
+
+    m = strstr (h->out->str, h->marker);
+    if (!m) {
+        if (h->out->len > HINT_ANSWER_MAX) {
+            /* Not worth showing; wait for the prompt */
+            h->cancelled = TRUE;
+            g_string_erase (h->out, 0, h->out->len - mlen + 1);
+        }
+        return;
+    }
+
+    answer = g_strndup (h->out->str, m - h->out->str);
+    g_string_truncate (h->out, 0);
+    answer_done (h, answer);
+    g_free (answer);
+}
+
+static void
+on_worker_exit (pio_env G_GNUC_UNUSED *env,
+                hinter                *h)
+{
+    g_message ("Type hints: worker exited");
+
+    h->env = NULL;
+    g_clear_pointer (&h->inflight, g_free);
+}
+
+static gboolean
+on_debounce (hinter *h)
+{
+    h->debounce = 0;
+
+    if (h->env && !h->inflight && h->wanted) {
+        send_query (h);
+    }
+    return G_SOURCE_REMOVE;
+}
+
+/**
+ * Start a worker ghci that answers :type queries for the hints. It runs at
+ * the lowest scheduling priority, and its output is read at
+ * G_PRIORITY_LOW, so that it never holds up the main session. Returns NULL
+ * if it could not be launched.
+ */
+hinter *
+hinter_new (gchar     **argv,
+            hint_func   func,
+            gpointer    data)
+{
+    hinter *h = g_malloc0 (sizeof (hinter));
+
+    h->env           = processio_env_new (NULL);
+    h->env->priority = G_PRIORITY_LOW;
+    h->env->nice     = HINT_NICE;
+
+    if (!processio_init (argv, &h->env, (pio_read_func) on_worker_read, h)) {
+        processio_env_free (h->env);
+        g_free (h);
+        return NULL;
+    }
+    h->env->exit_func = (pio_exit_func) on_worker_exit;
+    h->env->exit_data = h;
+
+    h->cache = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+    h->out   = g_string_new (NULL);
+    h->func  = func;
+    h->data  = data;
+
+    /* The first query loads the type checker, ready for the real ones */
+    h->wanted = g_strdup ("()");
+    send_query (h);
+
+    return h;
+}
+
+/**
+ * The entry now reads expr. Returns FALSE if it is not something with a
+ * type; otherwise h's callback is called with the type, right away if it
+ * is known, or once the worker has been asked. A query still running for
+ * earlier text is interrupted, once the worker has got to it.
+ */
+gboolean
+hinter_query (hinter       *h,
+              const gchar  *expr)
+{
+    const gchar *type;
+    gchar       *e = g_strstrip (g_strdup (expr));
+
+    if (!*e || ':' == *e || strchr (e, '\n') || first_word_is (e, skip_keywords)
+            || !h->env) {
+        g_free (e);
+        return FALSE;
+    }
+
+    g_free (h->wanted);
+    h->wanted = e;
+
+    if (h->debounce) {
+        g_source_remove (h->debounce);
+        h->debounce = 0;
+    }
+
+    type = g_hash_table_lookup (h->cache, e);
+    if (type) {
+        h->func (h, e, *type ? type : NULL, h->data);
+        return TRUE;
+    }
+
+    if (h->inflight && !h->cancelled && h->opened && strcmp (h->inflight, e)) {
+        /* Stale; the answer comes back as soon as ghci notices. Before its
+         * marker, the worker may still be running a replayed :load or
+         * import, which must not be cut short; the answer is then left to
+         * arrive, and is only cached. */
+        h->cancelled = TRUE;
+        processio_interrupt (h->env);
+    }
+
+    h->debounce = g_timeout_add_full (G_PRIORITY_LOW, HINT_DEBOUNCE_MS,
+                                      (GSourceFunc) on_debounce, h, NULL);
+    return TRUE;
+}
+
+/**
+ * A command sent to the main session. Imports, bindings, declarations,
+ * :load and :reload are run by the worker too, so that it knows the same
+ * names. They only define things; nothing is evaluated.
+ */
+void
+hinter_track (hinter       *h,
+              const gchar  *command)
+{
+    gchar *line;
+    guint  i;
+
+    while (g_ascii_isspace (*command)) {
+        ++command;
+    }
+    if (!h->env || strchr (command, '\n')) {
+        return;
+    }
+
+    for (i = 0; track_prefixes[i]; ++i) {
+        if (g_str_has_prefix (command, track_prefixes[i])) {
+            break;
+        }
+    }
+    if (!track_prefixes[i] && !first_word_is (command, track_commands)) {
+        return;
+    }
+
+    line = g_strconcat (command, "\n", NULL);
+    processio_write (h->env, line, -1);
+    g_free (line);
+
+    g_hash_table_remove_all (h->cache);
+}
+
+static void
+ignore_read (pio_stream G_GNUC_UNUSED  stream,
+             guint8     G_GNUC_UNUSED *data,
+             gsize      G_GNUC_UNUSED  bytes,
+             gpointer   G_GNUC_UNUSED  user_data)
+{
+}
+
+void
+hinter_free (hinter *h)
+{
+    if (h->debounce) {
+        g_source_remove (h->debounce);
+    }
+    if (h->env) {
+        h->env->exit_func = NULL;
+        h->env->read_func = ignore_read;
+        processio_kill (h->env);
+    }
+
+    g_hash_table_destroy (h->cache);
+    g_string_free (h->out, TRUE);
+    g_free (h->marker);
+    g_free (h->inflight);
+    g_free (h->wanted);
+    g_free (h);
+}
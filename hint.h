@@ -0,0 +1,27 @@
+#ifndef HINT_H
+#define HINT_H
+
+#include "processio.h"
+
+G_BEGIN_DECLS
+
+#define HINT_DEBOUNCE_MS    50
+#define HINT_CACHE_MAX      1024    /* Answers kept before starting over */
+#define HINT_ANSWER_MAX     (16 * 1024)
+#define HINT_NICE           19
+
+typedef struct _hinter hinter;
+
+/* Called with the type of the expression last passed to hinter_query (),
+ * or NULL if it has none (a type error, or not an expression) */
+typedef void (*hint_func) (hinter *h, const gchar *expr, const gchar *type,
+                           gpointer user_data);
+
+hinter   *hinter_new   (gchar **argv, hint_func func, gpointer data);
+gboolean  hinter_query (hinter *h, const gchar *expr);
+void      hinter_track (hinter *h, const gchar *command);
+void      hinter_free  (hinter *h);
+
+G_END_DECLS
+
+#endif /* HINT_H */
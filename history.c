@@ -0,0 +1,144 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <glib/gstdio.h>
+#include "history.h"
+#include "trace.h"
+
+/**
+ * Where commands are kept between sessions, one per line, escaped with
+ * g_strescape () so that pasted newlines survive.
+ */
+gchar *
+history_path (void)
+{
+    return g_build_filename (g_get_user_data_dir (), "gtk-ghci", "history",
+                             NULL);
+}
+
+static void
+load_thread (GTask                      *task,
+             gpointer      G_GNUC_UNUSED source,
+             const gchar                *path,
+             GCancellable G_GNUC_UNUSED *cancellable)
+{
+    gchar     *contents;
+    gchar    **lines;
+    GPtrArray *commands;
+    GError    *error = NULL;
+    guint      n,
+               first,
+               i;
+
+    TRACE_BEGIN ("history.load");
+
+    if (!g_file_get_contents (path, &contents, NULL, &error)) {
+        if (g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+            /* First run */
+            g_error_free (error);
+            g_task_return_pointer (task, g_new0 (gchar *, 1),
+                                   (GDestroyNotify) g_strfreev);
+        } else {
+            g_task_return_error (task, error);
+        }
+        TRACE_END ("history.load");
+        return;
+    }
+
+    lines = g_strsplit (contents, "\n", -1);
+    g_free (contents);
+
+    n = g_strv_length (lines);
+    if (n && !*lines[n - 1]) {
+        --n;
+    }
+    first = n > HISTORY_MAX ? n - HISTORY_MAX : 0;
+
+    if (n > 2 * HISTORY_MAX) {
+        /* Appending is all a session does; trim the file now and then. A
+         * command appended while this runs may be lost. */
+        gchar *tail;
+
+        g_free (lines[n]);
+        lines[n] = NULL;
+        tail = g_strjoinv ("\n", lines + first);
+        contents = g_strconcat (tail, "\n", NULL);
+        if (!g_file_set_contents (path, contents, -1, &error)) {
+            g_warning ("%s", error->message);
+            g_clear_error (&error);
+        }
+        g_free (contents);
+        g_free (tail);
+    }
+
+    commands = g_ptr_array_sized_new (n - first + 1);
+    for (i = first; i < n; ++i) {
+        if (*lines[i]) {
+            g_ptr_array_add (commands, g_strcompress (lines[i]));
+        }
+    }
+    g_ptr_array_add (commands, NULL);
+    g_strfreev (lines);
+
+    TRACE_COUNTER ("history.commands", commands->len - 1);
+    TRACE_END ("history.load");
+
+    g_task_return_pointer (task, g_ptr_array_free (commands, FALSE),
+                           (GDestroyNotify) g_strfreev);
+}
+
+/**
+ * Read the last HISTORY_MAX commands from path in a worker thread. The
+ * result is a NULL-terminated array, oldest command first.
+ */
+void
+history_load_async (const gchar         *path,
+                    GAsyncReadyCallback  callback,
+                    gpointer             data)
+{
+    GTask *task = g_task_new (NULL, NULL, callback, data);
+
+    g_task_set_task_data (task, g_strdup (path), g_free);
+    g_task_run_in_thread (task, (GTaskThreadFunc) load_thread);
+    g_object_unref (task);
+}
+
+gchar **
+history_load_finish (GAsyncResult  *result,
+                     GError       **error)
+{
+    return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+gboolean
+history_append (const gchar  *path,
+                const gchar  *command,
+                GError      **error)
+{
+    FILE  *f;
+    gchar *dir,
+          *line;
+    int    ok;
+
+    dir = g_path_get_dirname (path);
+    g_mkdir_with_parents (dir, 0700);
+    g_free (dir);
+
+    f = g_fopen (path, "a");
+    if (!f) {
+        g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+                     "%s: %s", path, g_strerror (errno));
+        return FALSE;
+    }
+
+    line = g_strescape (command, NULL);
+    ok   = fprintf (f, "%s\n", line) >= 0;
+    g_free (line);
+
+    if (fclose (f) || !ok) {
+        g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+                     "%s: %s", path, g_strerror (errno));
+        return FALSE;
+    }
+    return TRUE;
+}
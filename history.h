@@ -0,0 +1,20 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+#define HISTORY_MAX     1000    /* Commands kept across sessions */
+
+gchar    *history_path        (void);
+void      history_load_async  (const gchar *path,
+                               GAsyncReadyCallback callback,
+                               gpointer data);
+gchar   **history_load_finish (GAsyncResult *result, GError **error);
+gboolean  history_append      (const gchar *path, const gchar *command,
+                               GError **error);
+
+G_END_DECLS
+
+#endif /* HISTORY_H */
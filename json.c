@@ -0,0 +1,37 @@
+#include "json.h"
+
+/**
+ * Write the contents of a JSON string literal (without the quotes). The
+ * data may be split across several calls at any byte.
+ */
+void
+json_write_string (FILE          *out,
+                   const guint8  *data,
+                   gsize          bytes)
+{
+    const guint8 *end = data + bytes,
+                 *run = data;
+
+    for (; data != end; ++data) {
+        if (*data >= 0x20 && '"' != *data && '\\' != *data) {
+            continue;
+        }
+
+        /* Write out the plain run, then the escaped character */
+        fwrite (run, 1, data - run, out);
+        run = data + 1;
+
+        switch (*data)
+        {
+        case '"':  fputs ("\\\"", out); break;
+        case '\\': fputs ("\\\\", out); break;
+        case '\n': fputs ("\\n", out);  break;
+        case '\r': fputs ("\\r", out);  break;
+        case '\t': fputs ("\\t", out);  break;
+        default:
+            fprintf (out, "\\u%04x", *data);
+            break;
+        }
+    }
+    fwrite (run, 1, end - run, out);
+}
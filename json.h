@@ -0,0 +1,13 @@
+#ifndef JSON_H
+#define JSON_H
+
+#include <stdio.h>
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+void json_write_string (FILE *out, const guint8 *data, gsize bytes);
+
+G_END_DECLS
+
+#endif /* JSON_H */
@@ -4,6 +4,19 @@
 #include <string.h>
 #include "processio.h"
 #include "ui.h"
+#include "batch.h"
+#include "export.h"
+#include "daemon.h"
+#include "reload.h"
+#include "cache.h"
+#include "commandentry.h"
+#include "wordindex.h"
+#include "history.h"
+#include "startup.h"
+#include "flood.h"
+#include "utf8.h"
+#include "hint.h"
+#include "trace.h"
 
 typedef struct _app app;
 
@@ -12,6 +25,7 @@ enum {
     READSTATE_PROMPT,
     READSTATE_BINDINGS,
     READSTATE_IMPORTS,
+    READSTATE_TYPE,
     LAST_READSTATE
 };
 
@@ -19,23 +33,112 @@ struct _app
 {
     GtkWidget    *window;
     pio_env      *io_env;
-    struct _ui   *ui;
+    struct _ui   *ui;           /* NULL when running headless */
+    batch        *batch;
+    reloader     *reloader;     /* Background :reload, NULL if off */
+    GString      *scope;        /* Answer to the last :show imports */
+    result_cache *cache;        /* NULL unless --cache-size is given */
+    hinter       *hinter;       /* NULL unless --type-hints is given */
+    flood        *flood;        /* Output rate watch, NULL when headless */
+    gboolean      flooded;      /* Output is going to the spill file */
+    gboolean      rebinding;    /* A cache hit is rebinding it, unseen */
+    guint         flood_tick;   /* Refreshes the flood bar meanwhile */
+    gchar        *history;      /* Where entered commands are kept */
+    GQueue        typeahead;    /* Commands entered before ghci was ready */
+    gboolean      ready;        /* The first bootstrap is done */
+    utf8_stream   utf8[2];      /* Validation of stdout and stderr */
+    GString      *utf8_scratch;
     guchar        tail[TAIL_SIZE];
     guint8        tlen;
     gboolean      ctrlc;
     guint8        state;
 };
 
+static gchar    *_opt_record      = NULL;
+static gchar    *_opt_replay      = NULL;
+static gboolean  _opt_replay_fast = FALSE;
+static gchar    *_opt_batch       = NULL;
+static gchar    *_opt_jsonl       = NULL;
+static gchar    *_opt_daemon      = NULL;
+static gchar    *_opt_connect     = NULL;
+static gchar    *_opt_share       = NULL;
+static gint      _opt_cache_size  = 0;
+static gboolean  _opt_type_hints  = FALSE;
+static gchar    *_opt_startup_log = NULL;
+
+static GMainLoop *_batch_loop     = NULL;
+static gboolean   _batch_failed   = FALSE;
+
+/* When the background loads started, for the startup report */
+static gint64     _index_started   = 0;
+static gint64     _history_started = 0;
+
+static GOptionEntry _options[] =
+{
+    { "record", 0, 0, G_OPTION_ARG_FILENAME, &_opt_record,
+      "Record the raw ghci byte stream to FILE", "FILE" },
+    { "replay", 0, 0, G_OPTION_ARG_FILENAME, &_opt_replay,
+      "Replay a recorded session instead of launching ghci", "FILE" },
+    { "replay-fast", 0, 0, G_OPTION_ARG_NONE, &_opt_replay_fast,
+      "Replay as fast as possible, ignoring the recorded timing", NULL },
+    { "batch", 0, 0, G_OPTION_ARG_FILENAME, &_opt_batch,
+      "Run without a display, reading commands from FILE (- for stdin)",
+      "FILE" },
+    { "jsonl", 0, 0, G_OPTION_ARG_FILENAME, &_opt_jsonl,
+      "In batch mode, write one JSON record per command to FILE", "FILE" },
+    { "daemon", 0, 0, G_OPTION_ARG_FILENAME, &_opt_daemon,
+      "Serve ghci sessions on the Unix socket SOCKET: a pre-started one "
+      "per client, or one per --share name",
+      "SOCKET" },
+    { "connect", 0, 0, G_OPTION_ARG_FILENAME, &_opt_connect,
+      "Take a pre-started ghci from the daemon at SOCKET instead of "
+      "launching one",
+      "SOCKET" },
+    { "share", 0, 0, G_OPTION_ARG_STRING, &_opt_share,
+      "With --connect, use the daemon's ghci of this name, together with "
+      "every other window that names it; bindings and loaded modules are "
+      "common to all of them, and their commands take turns",
+      "NAME" },
+    { "cache-size", 0, 0, G_OPTION_ARG_INT, &_opt_cache_size,
+      "Replay results of repeated pure expressions from a cache of MB "
+      "megabytes", "MB" },
+    { "type-hints", 0, 0, G_OPTION_ARG_NONE, &_opt_type_hints,
+      "Show the type of the input as it is typed, from a second ghci. "
+      "It replays :load, so a loaded project takes twice the memory; "
+      "it runs at nice 19, which lowers its CPU priority only", NULL },
+    { "startup-log", 0, 0, G_OPTION_ARG_FILENAME, &_opt_startup_log,
+      "Append the startup timings to FILE as one JSON record per run",
+      "FILE" },
+    { NULL }
+};
+
 static gboolean
 on_window_destroy (GtkWidget G_GNUC_UNUSED *object,
                    GdkEvent  G_GNUC_UNUSED *event,
                    app                     *obj)
 {
-    if (!kill (obj->io_env->pid, SIGKILL)) {
-        g_message ("SIGKILL");
-    }
+    processio_kill (obj->io_env);
 
+    if (obj->reloader) {
+        reloader_free (obj->reloader);
+    }
+    if (obj->cache) {
+        result_cache_free (obj->cache);
+    }
+    if (obj->hinter) {
+        hinter_free (obj->hinter);
+    }
+    if (obj->flood_tick) {
+        g_source_remove (obj->flood_tick);
+    }
+    flood_free (obj->flood);
+    g_queue_clear_full (&obj->typeahead, g_free);
+    g_free (obj->history);
+    search_free (obj->ui->search);
+    outview_free (obj->ui->out);
     g_free (obj->ui);
+    g_string_free (obj->utf8_scratch, TRUE);
+    g_string_free (obj->scope, TRUE);
     g_free (obj);
 
     return TRUE;
@@ -49,6 +152,53 @@ io_write (GIOChannel   *channel,
     g_io_channel_flush (channel, NULL);
 }
 
+static void
+on_export_done (GObject      G_GNUC_UNUSED *source,
+                GAsyncResult               *result,
+                gchar                      *path)
+{
+    GError *error = NULL;
+
+    if (export_finish (result, &error)) {
+        g_message ("Transcript saved to %s", path);
+    } else {
+        g_warning ("%s", error->message);
+        g_error_free (error);
+    }
+    g_free (path);
+}
+
+static void
+save_transcript (app *obj)
+{
+    GtkWidget     *dialog;
+    gchar         *path;
+    export_format  format;
+
+    dialog = gtk_file_chooser_dialog_new ("Save Transcript",
+                                          GTK_WINDOW (obj->window),
+                                          GTK_FILE_CHOOSER_ACTION_SAVE,
+                                          "_Cancel", GTK_RESPONSE_CANCEL,
+                                          "_Save", GTK_RESPONSE_ACCEPT,
+                                          NULL);
+    gtk_file_chooser_set_do_overwrite_confirmation (GTK_FILE_CHOOSER (dialog),
+                                                    TRUE);
+    gtk_file_chooser_set_current_name (GTK_FILE_CHOOSER (dialog),
+                                       "transcript.txt");
+
+    if (GTK_RESPONSE_ACCEPT == gtk_dialog_run (GTK_DIALOG (dialog))) {
+        path = gtk_file_chooser_get_filename (GTK_FILE_CHOOSER (dialog));
+
+        /* A .jsonl file gets one record per command */
+        format = g_str_has_suffix (path, ".jsonl") ? EXPORT_JSONL
+                                                   : EXPORT_TEXT;
+
+        export_async (obj->ui->out->transcript, path, format,
+                      (GAsyncReadyCallback) on_export_done, path);
+    }
+    gtk_widget_destroy (dialog);
+}
+
 static gboolean
 on_key_pressed (GtkWidget   G_GNUC_UNUSED *object,
                 GdkEventKey G_GNUC_UNUSED *event,
@@ -59,43 +209,62 @@ on_key_pressed (GtkWidget   G_GNUC_UNUSED *object,
     case GDK_KEY_C:
     case GDK_KEY_c:
         if (event->state & GDK_CONTROL_MASK) {
-            if (!kill (obj->io_env->pid, SIGINT)) {
+            if (processio_interrupt (obj->io_env)) {
                 obj->ctrlc = TRUE;
                 g_message ("SIGINT");
                 return TRUE;
             }
         }
+        break;
+    case GDK_KEY_F:
+    case GDK_KEY_f:
+        if (event->state & GDK_CONTROL_MASK) {
+            gtk_search_bar_set_search_mode (GTK_SEARCH_BAR (obj->ui->search_bar),
+                                            TRUE);
+            return TRUE;
+        }
+        break;
+    case GDK_KEY_S:
+    case GDK_KEY_s:
+        if (event->state & GDK_CONTROL_MASK) {
+            save_transcript (obj);
+            return TRUE;
+        }
+        break;
+#ifdef ENABLE_TRACE
+    case GDK_KEY_F12:
+        /* Only while the GUI responds; SIGUSR1 works regardless */
+        TRACE_DUMP ();
+        return TRUE;
+#endif
     }
     return FALSE;
 }
 
 static void
-on_button_clicked (GtkWidget  G_GNUC_UNUSED *button,
-                   app                      *obj)
+on_queue_changed (pio_env G_GNUC_UNUSED *env,
+                  gsize                  queued,
+                  app                   *obj)
 {
-    const gchar *text = gtk_entry_get_text (GTK_ENTRY (obj->ui->entry));
-
-    if (*text) {
-        GtkTextIter    iter;
-        GtkTextBuffer *buffer;
-
-        buffer = gtk_text_view_get_buffer (GTK_TEXT_VIEW (obj->ui->view));
-
-        gtk_text_buffer_get_end_iter (buffer, &iter);
-        gtk_text_buffer_insert (buffer, &iter, text, strlen (text));
-        gtk_text_buffer_insert (buffer, &iter, "\n", 1);
+    gchar *label;
 
-        g_io_channel_write_chars (obj->io_env->io_in, text, -1, NULL, NULL);
-        if (!g_str_has_suffix (text, "\n")) {
-            g_io_channel_write_chars (obj->io_env->io_in, "\n", 1, NULL, NULL);
-        }
-        g_io_channel_flush (obj->io_env->io_in, NULL);
-
-        g_io_channel_flush (obj->io_env->io_out, NULL);
-        g_io_channel_flush (obj->io_env->io_err, NULL);
+    if (!obj->ui) {
+        return;
+    }
 
-        obj->ctrlc = FALSE;
-        gtk_entry_set_text (GTK_ENTRY (obj->ui->entry), "");
+    if (queued) {
+        /* Show the backlog while a large paste is being written */
+        label = g_strdup_printf ("Sending %" G_GSIZE_FORMAT " KB",
+                                 (queued + 1023) / 1024);
+        gtk_button_set_label (GTK_BUTTON (obj->ui->btn), label);
+        g_free (label);
+    } else if (!g_queue_is_empty (&obj->typeahead)) {
+        label = g_strdup_printf ("Queued (%u)",
+                                 g_queue_get_length (&obj->typeahead));
+        gtk_button_set_label (GTK_BUTTON (obj->ui->btn), label);
+        g_free (label);
+    } else {
+        gtk_button_set_label (GTK_BUTTON (obj->ui->btn), "Run");
     }
 }
 
@@ -104,31 +273,532 @@ scroll_to_end (GtkTextView *view)
 {
     GtkAdjustment *adj = gtk_scrollable_get_vadjustment (GTK_SCROLLABLE (view));
 
+    TRACE_BEGIN ("scroll_to_end");
+
     gtk_adjustment_set_value (adj, gtk_adjustment_get_upper (adj));
     gtk_scrollable_set_vadjustment (GTK_SCROLLABLE (view), adj);
 
     while (gtk_events_pending ()) {
         gtk_main_iteration ();
     }
+
+    TRACE_END ("scroll_to_end");
 }
 
 static void
-print_out (GtkTextView   *view,
+print_out (ui            *ui,
            guint8        *data,
            gsize          bytes)
 {
-    GtkTextBuffer *buffer;
-    GtkTextIter    iter;
+    TRACE_BEGIN ("print_out");
+    TRACE_COUNTER ("print_out.bytes", bytes);
+
+    outview_append (ui->out, (const gchar *) data, bytes);
+    search_update (ui->search);
+
+    scroll_to_end (ui->out->view);
+    scroll_to_end (ui->out->view);
+
+    TRACE_END ("print_out");
+}
+
+/**
+ * Echo a command and send it to ghci, or replay its cached result. Returns
+ * TRUE if ghci was given the command.
+ */
+static gboolean
+run_command (app          *obj,
+             const gchar  *text)
+{
+    GBytes   *hit  = NULL;
+    gchar    *rebind = NULL;
+    gboolean  idle;
+    gsize     size;
+
+    if (obj->cache) {
+        idle = READSTATE_USER == obj->state && !obj->ui->out->in_response;
+        hit  = result_cache_submit (obj->cache, text, idle, &rebind);
+    }
+
+    /* The echo goes through the output view so that the transcript
+     * holds the same text as the buffer, less what is folded */
+    outview_begin_command (obj->ui->out);
+    print_out (obj->ui, (guint8 *) text, strlen (text));
+    print_out (obj->ui, (guint8 *) "\n", 1);
+    outview_begin_output (obj->ui->out);
+
+    /* Whatever was cut off by an interrupt is gone */
+    utf8_stream_init (&obj->utf8[0]);
+    utf8_stream_init (&obj->utf8[1]);
+    if (obj->ctrlc) {
+        obj->io_env->active = PIO_STREAM_NONE;
+        g_byte_array_set_size (obj->io_env->buffer, 0);
+        obj->ctrlc = FALSE;
+    }
+
+    if (hit) {
+        /* Same expression, same session: ghci would say the same. It still
+         * has to bind it to the value, which let does without evaluating
+         * anything; the command ends at its prompt as usual. */
+        print_out (obj->ui, (guint8 *) g_bytes_get_data (hit, &size),
+                   size);
+        g_bytes_unref (hit);
+
+        obj->rebinding = TRUE;
+        processio_submit (obj->io_env, rebind);
+        g_free (rebind);
+        return TRUE;
+    }
+
+    if (obj->reloader) {
+        reloader_track (obj->reloader, text);
+    }
+    if (obj->hinter) {
+        hinter_track (obj->hinter, text);
+    }
+    processio_submit (obj->io_env, text);
+    return TRUE;
+}
+
+/**
+ * Run the commands typed ahead of the first prompt, up to the first one
+ * that ghci has to answer.
+ */
+static void
+run_typeahead (app *obj)
+{
+    gchar    *text;
+    gboolean  sent = FALSE;
+
+    while (!sent && (text = g_queue_pop_head (&obj->typeahead))) {
+        sent = run_command (obj, text);
+        g_free (text);
+    }
+    on_queue_changed (obj->io_env, processio_get_queued (obj->io_env), obj);
+}
+
+static void
+flush_block (GPtrArray *commands,
+             GString   *block)
+{
+    if (block->len) {
+        g_ptr_array_add (commands, g_strndup (block->str, block->len - 1));
+        g_string_truncate (block, 0);
+    }
+}
 
-    buffer = gtk_text_view_get_buffer (view);
+/**
+ * Split pasted input into the commands that ghci is to run one at a time.
+ * A line starting with ':' is a command of its own, and the lines between
+ * such commands form a block, which processio_submit () wraps in :{ ... :}.
+ * A :{ ... :} block in the input stays whole.
+ */
+static GPtrArray *
+split_commands (const gchar *text)
+{
+    GPtrArray  *commands = g_ptr_array_new ();
+    GString    *block    = g_string_new (NULL);
+    gchar     **lines    = g_strsplit (text, "\n", -1);
+    gboolean    explicit = FALSE;
+    guint       i;
+
+    for (i = 0; lines[i]; ++i) {
+        const gchar *line = lines[i];
+
+        if (explicit) {
+            g_string_append (block, line);
+            g_string_append_c (block, '\n');
+            if (g_str_has_prefix (line, ":}")) {
+                flush_block (commands, block);
+                explicit = FALSE;
+            }
+        } else if (g_str_has_prefix (line, ":{")) {
+            flush_block (commands, block);
+            g_string_append (block, line);
+            g_string_append_c (block, '\n');
+            explicit = TRUE;
+        } else if (':' == *line) {
+            flush_block (commands, block);
+            g_ptr_array_add (commands, g_strdup (line));
+        } else if (block->len || line[strspn (line, " \t\r")]) {
+            g_string_append (block, line);
+            g_string_append_c (block, '\n');
+        }
+    }
+    flush_block (commands, block);
+
+    g_strfreev (lines);
+    g_string_free (block, TRUE);
+
+    return commands;
+}
+
+static void
+on_button_clicked (GtkWidget  G_GNUC_UNUSED *button,
+                   app                      *obj)
+{
+    gchar     *text  = g_strdup (gtk_entry_get_text (GTK_ENTRY (obj->ui->entry)));
+    GError    *error = NULL;
+    GPtrArray *commands;
+    guint      i;
+
+    if (*text) {
+        gtk_entry_set_text (GTK_ENTRY (obj->ui->entry), "");
+
+        if (!history_append (obj->history, text, &error)) {
+            g_warning ("%s", error->message);
+            g_error_free (error);
+        }
+
+        if (strchr (text, '\n')) {
+            /* ghci commands cannot go in a :{ ... :} block; each part of
+             * the paste waits for the prompt of the one before */
+            commands = split_commands (text);
+            for (i = 0; i < commands->len; ++i) {
+                g_queue_push_tail (&obj->typeahead,
+                                   g_ptr_array_index (commands, i));
+            }
+            g_ptr_array_free (commands, TRUE);
+            g_free (text);
+
+            if (obj->ready && READSTATE_USER == obj->state
+                    && !obj->ui->out->in_response) {
+                run_typeahead (obj);
+            } else {
+                on_queue_changed (obj->io_env,
+                                  processio_get_queued (obj->io_env), obj);
+            }
+            return;
+        }
+
+        if (!obj->ready || !g_queue_is_empty (&obj->typeahead)) {
+            /* ghci is still starting up; the bootstrap queries must come
+             * first, so hold on to the command until the prompt shows */
+            g_queue_push_tail (&obj->typeahead, text);
+            on_queue_changed (obj->io_env,
+                              processio_get_queued (obj->io_env), obj);
+            return;
+        }
+
+        run_command (obj, text);
+    }
+    g_free (text);
+}
+
+static void
+collect_text (const gchar              *text,
+              gsize                     len,
+              guint32      G_GNUC_UNUSED style,
+              GString                  *s)
+{
+    g_string_append_len (s, text, len);
+}
+
+/**
+ * The last lines of the output spilled so far, readable in a label.
+ */
+static gchar *
+flood_tail_text (flood *f)
+{
+    ansi_parser   parser;
+    GString      *s = g_string_new (NULL);
+    const guint8 *data;
+    const gchar  *p,
+                 *end;
+    gsize         len;
+    guint         lines = 0;
+
+    data = flood_tail (f, &len);
+    ansi_parser_init (&parser);
+    ansi_parser_feed (&parser, (const gchar *) data, len,
+                      (ansi_text_func) collect_text, s);
+
+    /* Start after the newline that precedes the last few lines */
+    while (s->len && '\n' == s->str[s->len - 1]) {
+        g_string_truncate (s, s->len - 1);
+    }
+    for (p = s->str + s->len; p > s->str; --p) {
+        if ('\n' == p[-1] && FLOOD_TAIL_LINES == ++lines) {
+            break;
+        }
+    }
+    g_string_erase (s, 0, p - s->str);
+
+    /* The tail may start or end within a character */
+    for (p = s->str; !g_utf8_validate (p, s->str + s->len - p, &end); ) {
+        gsize at = end - s->str;
+
+        g_string_erase (s, at, 1);
+        g_string_insert (s, at, "\xef\xbf\xbd");
+        p = s->str + at + 3;
+    }
+
+    return g_string_free (s, FALSE);
+}
+
+static void
+flood_show (app *obj)
+{
+    gchar *rate = g_format_size ((guint64) flood_rate (obj->flood)),
+          *size = g_format_size (flood_spilled (obj->flood)),
+          *text,
+          *dropped,
+          *full;
+
+    if (obj->flooded) {
+        text = g_strdup_printf ("Output flood: %s/s, %s written to %s", rate,
+                                size, flood_path (obj->flood));
+    } else {
+        text = g_strdup_printf ("%s of output written to %s", size,
+                                flood_path (obj->flood));
+    }
+    if (flood_dropped (obj->flood)) {
+        dropped = g_format_size (flood_dropped (obj->flood));
+        full    = g_strdup_printf ("%s (full; %s more dropped)", text, dropped);
+        g_free (text);
+        g_free (dropped);
+        text = full;
+    }
+    gtk_label_set_text (GTK_LABEL (obj->ui->flood_label), text);
+    g_free (text);
+
+    /* Only a running command can be interrupted */
+    gtk_info_bar_set_response_sensitive (GTK_INFO_BAR (obj->ui->flood_bar),
+                                         GTK_RESPONSE_REJECT,
+                                         obj->ui->out->in_response);
+
+    text = flood_tail_text (obj->flood);
+    gtk_label_set_text (GTK_LABEL (obj->ui->flood_tail), text);
+    g_free (text);
+
+    gtk_widget_show (obj->ui->flood_bar);
+
+    g_free (size);
+    g_free (rate);
+}
+
+static gboolean
+on_flood_tick (app *obj)
+{
+    flood_show (obj);
+
+    return G_SOURCE_CONTINUE;
+}
+
+/**
+ * Output is back to a pace the view can follow, or the command is done:
+ * leave a note of what was spilled, and the last lines, in the view.
+ */
+static void
+flood_settle (app *obj)
+{
+    const guint8 *tail;
+    const guint8 *nl;
+    gchar        *size,
+                 *dropped,
+                 *note;
+    gsize         len;
+
+    obj->flooded = FALSE;
+    g_source_remove (obj->flood_tick);
+    obj->flood_tick = 0;
+
+    size    = g_format_size (flood_spilled (obj->flood));
+    dropped = g_format_size (flood_dropped (obj->flood));
+    if (flood_dropped (obj->flood)) {
+        note = g_strdup_printf ("[… %s of output written to %s, %s more "
+                                "dropped …]\n", size, flood_path (obj->flood),
+                                dropped);
+    } else {
+        note = g_strdup_printf ("[… %s of output written to %s …]\n", size,
+                                flood_path (obj->flood));
+    }
+    print_out (obj->ui, (guint8 *) note, strlen (note));
+    g_free (note);
+    g_free (dropped);
+    g_free (size);
+
+    tail = flood_tail (obj->flood, &len);
+    if (FLOOD_TAIL_BYTES == len && (nl = memchr (tail, '\n', len))) {
+        /* Whole lines only */
+        len -= nl + 1 - tail;
+        tail = nl + 1;
+    }
+    print_out (obj->ui, (guint8 *) tail, len);
+
+    flood_show (obj);
+}
+
+static void
+on_flood_response (GtkInfoBar *bar,
+                   gint        response,
+                   app        *obj)
+{
+    GError *error = NULL;
+    gchar  *uri;
+
+    if (GTK_RESPONSE_REJECT == response) {
+        /* As Ctrl+C, for a command whose output will not stop */
+        if (processio_interrupt (obj->io_env)) {
+            obj->ctrlc = TRUE;
+            g_message ("SIGINT");
+        }
+        return;
+    }
+    if (GTK_RESPONSE_ACCEPT != response) {
+        gtk_widget_hide (GTK_WIDGET (bar));
+        return;
+    }
+
+    uri = g_filename_to_uri (flood_path (obj->flood), NULL, &error);
+    if (!uri || !g_app_info_launch_default_for_uri (uri, NULL, &error)) {
+        g_warning ("%s", error->message);
+        g_error_free (error);
+    }
+    g_free (uri);
+}
+
+static void
+emit_text (app     *obj,
+           guint8  *data,
+           gsize    bytes)
+{
+    if (obj->rebinding && READSTATE_USER == obj->state) {
+        /* The replayed result has been shown already */
+        return;
+    }
+    if (obj->cache && READSTATE_USER == obj->state) {
+        result_cache_output (obj->cache, obj->io_env->active, data, bytes);
+    }
+
+    if (obj->batch) {
+        batch_output (obj->batch, data, bytes);
+        return;
+    }
+
+    if (flood_feed (obj->flood, data, bytes)) {
+        /* More than the view can take; ghci is not kept waiting for it */
+        if (!obj->flooded) {
+            obj->flooded    = TRUE;
+            obj->flood_tick = g_timeout_add (FLOOD_REFRESH_MS,
+                                             (GSourceFunc) on_flood_tick, obj);
+            flood_show (obj);
+        }
+        return;
+    }
+
+    if (obj->flooded) {
+        flood_settle (obj);
+    }
+    print_out (obj->ui, data, bytes);
+}
+
+static utf8_stream *
+stream_utf8 (app *obj)
+{
+    return &obj->utf8[PIO_STREAM_ERR == obj->io_env->active];
+}
+
+/**
+ * Everything shown goes through here first. Chunks end anywhere, often
+ * within a character; only whole, valid characters are passed on.
+ */
+static void
+emit_output (app     *obj,
+             guint8  *data,
+             gsize    bytes)
+{
+    const gchar *text;
+    gsize        len;
+
+    text = utf8_stream_feed (stream_utf8 (obj), data, bytes,
+                             obj->utf8_scratch, &len);
+    if (len) {
+        emit_text (obj, (guint8 *) text, len);
+    }
+}
+
+/**
+ * The active stream has reached a prompt; it will not complete a character
+ * it left unfinished.
+ */
+static void
+emit_finish (app *obj)
+{
+    const gchar *text;
+    gsize        len;
+
+    text = utf8_stream_finish (stream_utf8 (obj), obj->utf8_scratch, &len);
+    if (len) {
+        emit_text (obj, (guint8 *) text, len);
+    }
+}
+
+/**
+ * Output of the queries run between commands, which is not shown.
+ */
+static void
+bootstrap_output (app     *obj,
+                  guint8  *data,
+                  gsize    bytes)
+{
+    if (READSTATE_IMPORTS == obj->state) {
+        /* For the reloader, to check a shadow's scope against */
+        g_string_append_len (obj->scope, (const gchar *) data, bytes);
+    }
+
+    if (!obj->cache) {
+        return;
+    }
+
+    switch (obj->state)
+    {
+    case READSTATE_BINDINGS:
+    case READSTATE_IMPORTS:
+        result_cache_session (obj->cache, data, bytes);
+        break;
+    case READSTATE_TYPE:
+        result_cache_type (obj->cache, data, bytes);
+        break;
+    default:
+        break;
+    }
+}
+
+static void
+on_entry_changed (GtkEditable *editable,
+                  app         *obj)
+{
+    const gchar *text = gtk_entry_get_text (GTK_ENTRY (editable));
 
-    gtk_text_buffer_get_end_iter (buffer, &iter);
-    gtk_text_buffer_insert (buffer, &iter, (const gchar *) data, bytes);
+    if (!obj->hinter || !hinter_query (obj->hinter, text)) {
+        gtk_label_set_text (GTK_LABEL (obj->ui->hint), "");
+        gtk_widget_set_tooltip_text (obj->ui->hint, NULL);
+    }
+}
 
-    scroll_to_end (view);
+static void
+on_hint (hinter       G_GNUC_UNUSED *h,
+         const gchar                *expr,
+         const gchar                *type,
+         app                        *obj)
+{
+    gchar *current,
+          *label;
+
+    current = g_strstrip (g_strdup (gtk_entry_get_text (
+                                        GTK_ENTRY (obj->ui->entry))));
+    if (strcmp (current, expr)) {
+        /* The entry has moved on */
+        g_free (current);
+        return;
+    }
+    g_free (current);
 
-    gtk_text_buffer_get_end_iter (buffer, &iter);
-    scroll_to_end (view);
+    label = type ? g_strconcat (":: ", type, NULL) : g_strdup ("");
+    gtk_label_set_text (GTK_LABEL (obj->ui->hint), label);
+    gtk_widget_set_tooltip_text (obj->ui->hint, type ? label : NULL);
+    g_free (label);
 }
 
 static void
@@ -136,7 +806,7 @@ on_auto_complete (GtkWidget  G_GNUC_UNUSED *button,
                   GString                  *data,
                   app                      *obj)
 {
-    print_out (GTK_TEXT_VIEW (obj->ui->view), (guint8 *) data->str, data->len);
+    print_out (obj->ui, (guint8 *) data->str, data->len);
 }
 
 static void
@@ -146,6 +816,8 @@ process (app    *obj,
 {
     gsize s = TAIL_SIZE - obj->tlen;
 
+    TRACE_BEGIN ("process");
+
     if (s && bytes <= s) {
         /* Append everything to tail */
         memcpy (obj->tail + obj->tlen, data, bytes);
@@ -158,10 +830,11 @@ process (app    *obj,
         if (x) {
             /* Flush out x first characters currently in tail buffer */
 
-            if (obj->io_env->io_err == obj->io_env->active
+            if (PIO_STREAM_ERR == obj->io_env->active
                     || READSTATE_USER == obj->state) {
-                print_out (GTK_TEXT_VIEW (obj->ui->view),
-                           obj->tail, x);
+                emit_output (obj, obj->tail, x);
+            } else {
+                bootstrap_output (obj, obj->tail, x);
             }
 
             if (t && x < t) {
@@ -179,10 +852,11 @@ process (app    *obj,
         s = TAIL_SIZE - obj->tlen;
         /* Flush out read buffer, but leave enough for tail... */
 
-        if (obj->io_env->io_err == obj->io_env->active
+        if (PIO_STREAM_ERR == obj->io_env->active
                 || READSTATE_USER == obj->state) {
-            print_out (GTK_TEXT_VIEW (obj->ui->view),
-                       (guint8 *) data, bytes - s);
+            emit_output (obj, (guint8 *) data, bytes - s);
+        } else {
+            bootstrap_output (obj, (guint8 *) data, bytes - s);
         }
 
         if (s) {
@@ -195,126 +869,303 @@ process (app    *obj,
             obj->tlen += s;
         }
     }
+
+    TRACE_END ("process");
+}
+
+/**
+ * Switch to a shadow session that has finished reloading, as long as the
+ * foreground session is idle at its prompt.
+ */
+static void
+try_swap (app *obj)
+{
+    GError      *error = NULL;
+    pio_env     *env;
+    const gchar *notice;
+
+    if (!obj->reloader || READSTATE_USER != obj->state
+            || obj->ui->out->in_response
+            || processio_get_queued (obj->io_env)) {
+        return;
+    }
+
+    env = reloader_take (obj->reloader, obj->scope->str, &error);
+    if (error) {
+        g_message ("Background reload not used: %s", error->message);
+        g_error_free (error);
+
+        notice = "-- Reloaded sources ready, but not the same scope; "
+                 ":reload to use them\n";
+        print_out (obj->ui, (guint8 *) notice, strlen (notice));
+        return;
+    }
+    if (!env) {
+        return;
+    }
+
+    processio_replace (obj->io_env, env);
+    obj->io_env = env;
+    obj->tlen   = 0;
+
+    if (obj->cache) {
+        result_cache_invalidate (obj->cache);
+    }
+    if (obj->hinter) {
+        /* The sources changed under the worker as well */
+        hinter_track (obj->hinter, ":reload");
+    }
+
+    notice = "-- Reloaded\n";
+    print_out (obj->ui, (guint8 *) notice, strlen (notice));
+}
+
+static void
+on_reload_ready (reloader     G_GNUC_UNUSED *r,
+                 gboolean                    ok,
+                 const gchar                *log,
+                 gdouble                     ms,
+                 app                        *obj)
+{
+    const gchar *notice = "-- Reload failed, :reload for details\n";
+
+    if (!ok) {
+        g_message ("Background reload failed after %.0f ms:\n%s", ms, log);
+        print_out (obj->ui, (guint8 *) notice, strlen (notice));
+        return;
+    }
+
+    g_message ("Background reload done in %.0f ms", ms);
+    try_swap (obj);
+}
+
+/**
+ * Once the window is on screen and ghci has shown its first prompt (or just
+ * the latter, without a display), report how long it took.
+ */
+static void
+report_startup (app *obj)
+{
+    if ((!obj->ui || startup_reached ("first-paint"))
+            && startup_reached ("first-prompt")) {
+        startup_report (_opt_startup_log);
+    }
 }
 
 static gboolean
-io_read (GIOChannel     *channel,
-         GIOCondition    cond,
-         app            *obj)
+on_first_draw (GtkWidget              *widget,
+               cairo_t G_GNUC_UNUSED  *cr,
+               app                    *obj)
 {
-    gsize          bytes;
-    GByteArray    *read_buf;
+    g_signal_handlers_disconnect_by_func (widget, on_first_draw, obj);
+
+    startup_milestone ("first-paint");
+    report_startup (obj);
 
-    if (cond == G_IO_HUP) {
-        return FALSE;
+    return FALSE;
+}
+
+/**
+ * Keep up to BATCH_PIPELINE_MAX commands queued ahead in ghci's stdin, so
+ * that it never waits for the next one; each prompt then ends the oldest.
+ * Stops the run once the script is exhausted and every command is done.
+ */
+static void
+batch_submit (app *obj)
+{
+    const gchar *command = NULL;
+    GError      *error   = NULL;
+
+    while (batch_in_flight (obj->batch) < BATCH_PIPELINE_MAX
+            && (command = batch_next (obj->batch, &error))) {
+        processio_write (obj->io_env, command, -1);
     }
 
-    read_buf = (obj->io_env->io_out == channel) ? obj->io_env->read_out
-                                                : obj->io_env->read_err;
+    if (error) {
+        g_printerr ("%s\n", error->message);
+        g_error_free (error);
+        _batch_failed = TRUE;
+        g_main_loop_quit (_batch_loop);
+    } else if (!command && !batch_pending (obj->batch)) {
+        g_main_loop_quit (_batch_loop);
+    }
+}
 
-    if (G_IO_STATUS_ERROR != g_io_channel_read_chars (channel,
-                                  (gchar *) read_buf->data,
-                                  READ_BUF_SIZE, &bytes, NULL))
-    {
-        if (obj->ctrlc) {
-            while (g_io_channel_get_buffer_condition (channel) & G_IO_IN) {
-                g_io_channel_flush (channel, NULL);
-                g_usleep (500);
-            }
+static void
+on_prompt (app      *obj,
+           gboolean  complete)
+{
+    if (obj->batch && READSTATE_USER == obj->state
+            && batch_pending (obj->batch)) {
+        /* Batch mode skips the bootstrap queries between commands, and a
+         * command is only done once the prompt shows up on stdout. Each
+         * prompt ends the oldest of the commands sent ahead. */
+        if (complete) {
+            batch_complete (obj->batch);
+            batch_submit (obj);
+        }
+        return;
+    }
 
-            obj->tlen = 0;
-            return TRUE;
+    if (!complete) {
+        /* A line of stderr; the response goes on until the prompt */
+        return;
+    }
+
+    if (obj->ui && READSTATE_USER == obj->state) {
+        obj->rebinding = FALSE;
+        if (obj->flooded) {
+            flood_settle (obj);
+        }
+        flood_finish (obj->flood);
+        outview_end_command (obj->ui->out);
+        gtk_info_bar_set_response_sensitive (GTK_INFO_BAR (obj->ui->flood_bar),
+                                             GTK_RESPONSE_REJECT, FALSE);
+    }
+
+    /* Respond according to application state */
+    switch (++obj->state)
+    {
+    case READSTATE_PROMPT:
+        processio_write (obj->io_env, ":set prompt \"Prelude> \"\n", -1);
+        break;
+    case READSTATE_BINDINGS:
+        processio_write (obj->io_env, ":show bindings\n", -1);
+        break;
+    case READSTATE_IMPORTS:
+        g_string_truncate (obj->scope, 0);
+        processio_write (obj->io_env, ":show imports\n", -1);
+        break;
+    case READSTATE_TYPE:
+        if (obj->cache && result_cache_type_query (obj->cache)) {
+            /* Only results of effect-free expressions are kept */
+            gchar *query = g_strdup_printf (":type %s\n",
+                                            result_cache_type_query (obj->cache));
+            processio_write (obj->io_env, query, -1);
+            g_free (query);
+            break;
+        }
+        ++obj->state;
+        /* Fall through */
+    case LAST_READSTATE:
+        obj->state = READSTATE_USER;
+        if (obj->cache) {
+            result_cache_complete (obj->cache);
+        }
+        if (!obj->ready) {
+            obj->ready = TRUE;
+            startup_milestone ("first-prompt");
+            report_startup (obj);
         }
+        if (obj->batch) {
+            batch_submit (obj);
+        } else {
+            /* A reload that finished while this command ran */
+            try_swap (obj);
+            run_typeahead (obj);
+        }
+    default:
+        break;
+    }
+}
 
-        if (bytes) {
+/**
+ * Run data from stream through prompt detection. Data of the other stream,
+ * held back while this one was active, is fed in turn once this stream's
+ * response or stderr line is finished.
+ */
+static void
+io_feed (pio_stream   stream,
+         guint8      *data,
+         gsize        bytes,
+         app         *obj)
+{
+    GByteArray *held;
+    gsize       n;
 
-            if (!obj->io_env->active) {
-                /* Set this channel as active */
-                obj->io_env->active = channel;
-            } else if (obj->io_env->active != channel) {
-                g_byte_array_append (obj->io_env->buffer, read_buf->data, bytes);
+    while (bytes) {
 
-                /* Keep UI responsive */
-                while (gtk_events_pending ()) {
-                    gtk_main_iteration ();
-                }
+        if (PIO_STREAM_NONE == obj->io_env->active) {
+            /* Set this stream as active */
+            obj->io_env->active = stream;
+        } else if (obj->io_env->active != stream) {
+            g_byte_array_append (obj->io_env->buffer, data, bytes);
+            return;
+        }
 
-                return TRUE;
+        /* Up to the first prompt; the rest follows it */
+        n = PIO_STREAM_OUT == stream
+          ? processio_prompt_end (obj->tail, obj->tlen, data, bytes) : 0;
+        if (!n) {
+            n = bytes;
+        }
+        process (obj, n, (gchar *) data);
+        data  += n;
+        bytes -= n;
+
+        if ((TAIL_SIZE == obj->tlen &&
+            !strncmp ((const gchar *) obj->tail, TAIL_STRING, TAIL_SIZE))
+         || (PIO_STREAM_ERR == obj->io_env->active &&
+             obj->tlen && '\n' == obj->tail[obj->tlen - 1]))
+        {
+            if (PIO_STREAM_ERR == obj->io_env->active) {
+                emit_output (obj, obj->tail, obj->tlen);
             }
+            emit_finish (obj);
 
-            process (obj, bytes, (gchar *) read_buf->data);
-
-            if ((TAIL_SIZE == obj->tlen &&
-                !strncmp ((const gchar *) obj->tail, TAIL_STRING, TAIL_SIZE))
-             || (obj->io_env->io_err == obj->io_env->active &&
-                 obj->tlen && '\n' == obj->tail[obj->tlen - 1]))
-            {
-                if (obj->io_env->io_err == obj->io_env->active) {
-                    print_out (GTK_TEXT_VIEW (obj->ui->view),
-                               obj->tail, obj->tlen);
-                }
-
-                if (obj->io_env->buffer->len) {
-                    g_byte_array_free (obj->io_env->buffer, TRUE);
-                    obj->io_env->buffer = g_byte_array_new ();
-                }
-
-                obj->tlen = 0;
-                obj->io_env->active = NULL;
-
-                /* Respond according to application state */
-                switch (++obj->state)
-                {
-                case READSTATE_PROMPT:
-                    g_io_channel_write_chars (obj->io_env->io_in,
-                                              ":set prompt \"Prelude> \"\n", -1,
-                                              NULL, NULL);
-                    g_io_channel_flush (obj->io_env->io_in, NULL);
-                    break;
-                case READSTATE_BINDINGS:
-                    g_io_channel_write_chars (obj->io_env->io_in,
-                                              ":show bindings\n", -1,
-                                              NULL, NULL);
-                    g_io_channel_flush (obj->io_env->io_in, NULL);
-                    break;
-                case READSTATE_IMPORTS:
-                    g_io_channel_write_chars (obj->io_env->io_in,
-                                              ":show imports\n", -1,
-                                              NULL, NULL);
-                    g_io_channel_flush (obj->io_env->io_in, NULL);
-                    break;
-                case LAST_READSTATE:
-                    obj->state = READSTATE_USER;
-                default:
-                    break;
-                }
-            }
-        }
+            obj->tlen = 0;
+            obj->io_env->active = PIO_STREAM_NONE;
+
+            on_prompt (obj, PIO_STREAM_OUT == stream);
 
-        /* Keep UI responsive */
-        while (gtk_events_pending ()) {
-            gtk_main_iteration ();
+            held = obj->io_env->buffer;
+            if (held->len) {
+                obj->io_env->buffer = g_byte_array_new ();
+                io_feed (PIO_STREAM_OUT == stream
+                             ? PIO_STREAM_ERR : PIO_STREAM_OUT,
+                         held->data, held->len, obj);
+                g_byte_array_free (held, TRUE);
+            }
         }
+    }
+}
 
-        return TRUE;
+static void
+io_handle (pio_stream   stream,
+           guint8      *data,
+           gsize        bytes,
+           app         *obj)
+{
+    if (obj->ctrlc) {
+        /* Discard output until the next command */
+        obj->tlen = 0;
+        return;
     }
 
-    return FALSE;
+    io_feed (stream, data, bytes, obj);
+
+    /* Keep UI responsive */
+    while (obj->ui && gtk_events_pending ()) {
+        gtk_main_iteration ();
+    }
 }
 
 static void
-activate (GtkApplication                *application,
-          gpointer        G_GNUC_UNUSED  user_data)
+io_read (pio_stream   stream,
+         guint8      *data,
+         gsize        bytes,
+         app         *obj)
 {
-    gchar     **args;
-    app        *obj;
-
-    obj         = g_malloc0 (sizeof (app));
-    obj->io_env = g_malloc0 (sizeof (pio_env));
-    obj->window = gtk_application_window_new (application);
+    TRACE_BEGIN ("io_read");
+    TRACE_COUNTER ("io_read.bytes", bytes);
+    io_handle (stream, data, bytes, obj);
+    TRACE_END ("io_read");
+}
 
-    /* Initialize child process */
-    args = g_malloc_n (5, sizeof (gchar *));
+static gchar **
+ghci_argv (void)
+{
+    gchar **args = g_malloc_n (5, sizeof (gchar *));
 
     args[0] = g_strdup ("/usr/lib/ghc/lib/ghc");
     args[1] = g_strdup ("-B/usr/lib/ghc");
@@ -322,18 +1173,158 @@ activate (GtkApplication                *application,
     args[3] = g_strdup ("-ignore-dot-ghci");
     args[4] = NULL;
 
-    obj->io_env->window   = obj->window;
-    obj->io_env->read_out = g_byte_array_sized_new (READ_BUF_SIZE);
-    obj->io_env->read_err = g_byte_array_sized_new (READ_BUF_SIZE);
-    obj->io_env->buffer   = g_byte_array_new ();
+    return args;
+}
 
-    if (!processio_init (args, &obj->io_env, (GSourceFunc) io_read, obj)) {
-        g_error ("Failed to launch ghci process.");
+static app *
+app_new (GtkWidget *window)
+{
+    app *obj = g_malloc0 (sizeof (app));
+
+    obj->window = window;
+    obj->io_env = processio_env_new (window);
+
+    obj->utf8_scratch = g_string_sized_new (READ_BUF_SIZE);
+    obj->scope        = g_string_new (NULL);
+    utf8_stream_init (&obj->utf8[0]);
+    utf8_stream_init (&obj->utf8[1]);
+
+    return obj;
+}
+
+/**
+ * Start the session's backend: a recording, a daemon-hosted session or a
+ * local ghci, in that order of preference.
+ */
+static gboolean
+session_start (app     *obj,
+               GError **error)
+{
+    gchar    **args;
+    gboolean   ok;
+
+    if (_opt_replay) {
+        return processio_replay_init (_opt_replay, _opt_replay_fast,
+                                      &obj->io_env, (pio_read_func) io_read,
+                                      obj, error);
+    }
+
+    if (_opt_connect) {
+        return processio_connect (_opt_connect, _opt_share, &obj->io_env,
+                                  (pio_read_func) io_read, obj, error);
     }
 
+    args = ghci_argv ();
+    ok   = processio_init (args, &obj->io_env, (pio_read_func) io_read, obj);
     g_strfreev (args);
 
+    if (!ok) {
+        g_set_error (error, G_SPAWN_ERROR, G_SPAWN_ERROR_FAILED,
+                     "Failed to launch ghci process.");
+    }
+    return ok;
+}
+
+static void
+on_index_loaded (GObject      G_GNUC_UNUSED *source,
+                 GAsyncResult               *result,
+                 CommandEntry               *entry)
+{
+    GError     *error = NULL;
+    word_index *idx   = word_index_load_finish (result, &error);
+
+    if (idx) {
+        command_entry_set_index (entry, idx);
+    } else {
+        g_message ("No completion index: %s", error->message);
+        g_error_free (error);
+    }
+    startup_phase ("index", _index_started);
+    g_object_unref (entry);
+}
+
+static void
+on_history_loaded (GObject      G_GNUC_UNUSED *source,
+                   GAsyncResult               *result,
+                   CommandEntry               *entry)
+{
+    GError  *error    = NULL;
+    gchar  **commands = history_load_finish (result, &error);
+
+    if (commands) {
+        command_entry_set_history (entry, commands);
+        g_strfreev (commands);
+    } else {
+        g_warning ("History: %s", error->message);
+        g_error_free (error);
+    }
+    startup_phase ("history", _history_started);
+    g_object_unref (entry);
+}
+
+static void
+activate (GtkApplication                *application,
+          gpointer        G_GNUC_UNUSED  user_data)
+{
+    app        *obj;
+    GError     *error = NULL;
+    gchar     **args;
+    gint64      t;
+
+    obj  = app_new (gtk_application_window_new (application));
+
+    /* Launch ghci first; it boots while everything else is set up, and
+     * commands entered before its first prompt are queued */
+    t = startup_now ();
+    if (!session_start (obj, &error)) {
+        g_error ("%s", error->message);
+    }
+    startup_phase ("spawn", t);
+
+    if (_opt_record && !processio_record (obj->io_env, _opt_record, &error)) {
+        g_warning ("%s", error->message);
+        g_clear_error (&error);
+    }
+
+    t = startup_now ();
     obj->ui = init_ui (obj->window);
+    obj->flood = flood_new ();
+    gtk_widget_grab_focus (obj->ui->entry);
+    startup_phase ("ui", t);
+
+    g_signal_connect_after (G_OBJECT (obj->window), "draw",
+                            G_CALLBACK (on_first_draw), obj);
+
+    if (_opt_cache_size > 0) {
+        obj->cache = result_cache_new ((gsize) _opt_cache_size * 1024 * 1024);
+    }
+
+    args = ghci_argv ();
+
+    if (!_opt_replay && !_opt_connect) {
+        obj->reloader = reloader_new (args, (reload_func) on_reload_ready,
+                                      obj);
+    }
+
+    /* A second ghci, at the lowest priority, for the type of the input */
+    if (_opt_type_hints && !_opt_replay) {
+        obj->hinter = hinter_new (args, (hint_func) on_hint, obj);
+    }
+
+    /* Completion names for this GHC, mapped (or built) off the main thread */
+    _index_started = startup_now ();
+    word_index_load_async (args, (GAsyncReadyCallback) on_index_loaded,
+                           g_object_ref (obj->ui->entry));
+    g_strfreev (args);
+
+    /* Commands from earlier sessions, also read in a worker thread */
+    obj->history     = history_path ();
+    _history_started = startup_now ();
+    history_load_async (obj->history, (GAsyncReadyCallback) on_history_loaded,
+                        g_object_ref (obj->ui->entry));
+
+    obj->io_env->queue_func = (pio_queue_func) on_queue_changed;
+    obj->io_env->queue_data = obj;
 
     g_signal_connect (G_OBJECT (obj->window), "delete-event",
                       G_CALLBACK (on_window_destroy),
@@ -354,14 +1345,133 @@ activate (GtkApplication                *application,
     g_signal_connect (G_OBJECT (obj->ui->entry), "auto-complete",
                       G_CALLBACK (on_auto_complete),
                       obj);
+
+    g_signal_connect (G_OBJECT (obj->ui->entry), "changed",
+                      G_CALLBACK (on_entry_changed),
+                      obj);
+
+    g_signal_connect (G_OBJECT (obj->ui->flood_bar), "response",
+                      G_CALLBACK (on_flood_response),
+                      obj);
+}
+
+static void
+on_batch_exit (pio_env G_GNUC_UNUSED *env,
+               app                   *obj)
+{
+    g_warning ("ghci exited before the batch was complete");
+
+    obj->io_env = NULL;
+    g_main_loop_quit (_batch_loop);
+}
+
+/**
+ * Run the commands in _opt_batch through the usual spawn, bootstrap and
+ * prompt detection, without a display.
+ */
+static int
+run_batch (void)
+{
+    app        *obj;
+    GError     *error = NULL;
+    int         status = 0;
+
+    obj        = app_new (NULL);
+    obj->batch = batch_new (_opt_batch, _opt_jsonl, &error);
+
+    if (!obj->batch) {
+        g_printerr ("%s\n", error->message);
+        g_error_free (error);
+        return 1;
+    }
+
+    if (!session_start (obj, &error)) {
+        g_printerr ("%s\n", error->message);
+        g_error_free (error);
+        processio_env_free (obj->io_env);
+        batch_free (obj->batch);
+        g_string_free (obj->utf8_scratch, TRUE);
+        g_string_free (obj->scope, TRUE);
+        g_free (obj);
+        return 1;
+    }
+
+    obj->io_env->exit_func = (pio_exit_func) on_batch_exit;
+    obj->io_env->exit_data = obj;
+
+    if (_opt_record && !processio_record (obj->io_env, _opt_record, &error)) {
+        g_warning ("%s", error->message);
+        g_clear_error (&error);
+    }
+
+    _batch_loop = g_main_loop_new (NULL, FALSE);
+    g_main_loop_run (_batch_loop);
+    g_main_loop_unref (_batch_loop);
+
+    if (obj->io_env) {
+        processio_kill (obj->io_env);
+    } else {
+        status = 1;
+    }
+    if (_batch_failed) {
+        status = 1;
+    }
+
+    batch_free (obj->batch);
+    g_string_free (obj->utf8_scratch, TRUE);
+    g_string_free (obj->scope, TRUE);
+    g_free (obj);
+
+    return status;
 }
 
 int
 main (int argc, char **argv)
 {
     GtkApplication *app;
+    GOptionContext *context;
+    GError         *error = NULL;
     int status;
-    
+
+    startup_init ();
+    TRACE_INIT ();
+
+    context = g_option_context_new (NULL);
+    g_option_context_add_main_entries (context, _options, NULL);
+    if (!g_option_context_parse (context, &argc, &argv, &error)) {
+        g_printerr ("%s\n", error->message);
+        g_error_free (error);
+        g_option_context_free (context);
+        return 1;
+    }
+    g_option_context_free (context);
+
+    if (_opt_daemon) {
+        gchar **args = ghci_argv ();
+
+        status = daemon_run (_opt_daemon, args, &error) ? 0 : 1;
+        if (error) {
+            g_printerr ("%s\n", error->message);
+            g_error_free (error);
+        }
+
+        g_strfreev (args);
+        g_free (_opt_daemon);
+
+        return status;
+    }
+
+    if (_opt_batch) {
+        status = run_batch ();
+
+        g_free (_opt_record);
+        g_free (_opt_batch);
+        g_free (_opt_jsonl);
+        g_free (_opt_startup_log);
+
+        return status;
+    }
+
     app = gtk_application_new ("org.gtk.example", G_APPLICATION_FLAGS_NONE);
     g_signal_connect (app, "activate", G_CALLBACK (activate), NULL);
     status = g_application_run (G_APPLICATION (app), argc, argv);
@@ -369,5 +1479,11 @@ main (int argc, char **argv)
     
     g_message ("Exiting gracefully...");
 
+    g_free (_opt_record);
+    g_free (_opt_replay);
+    g_free (_opt_connect);
+    g_free (_opt_share);
+    g_free (_opt_startup_log);
+
     return status;
 }
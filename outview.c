@@ -0,0 +1,714 @@
+#include <string.h>
+#include "outview.h"
+#include "trace.h"
+
+static const gchar *_palette[16] =
+{
+    "#000000", "#cd0000", "#00cd00", "#cdcd00",
+    "#0000ee", "#cd00cd", "#00cdcd", "#e5e5e5",
+    "#7f7f7f", "#ff0000", "#00ff00", "#ffff00",
+    "#5c5cff", "#ff00ff", "#00ffff", "#ffffff"
+};
+
+static const guint8 _cube[6] = { 0, 95, 135, 175, 215, 255 };
+
+typedef struct
+{
+    guint64 offset;             /* Transcript offset of the change */
+    guint32 style;
+} outview_span;
+
+static void
+color_spec (guint idx, gchar spec[8])
+{
+    guint8 r, g, b;
+
+    if (idx < 16) {
+        strcpy (spec, _palette[idx]);
+        return;
+    }
+
+    if (idx < 232) {
+        idx -= 16;
+        r = _cube[idx / 36];
+        g = _cube[(idx / 6) % 6];
+        b = _cube[idx % 6];
+    } else {
+        r = g = b = 8 + 10 * (idx - 232);
+    }
+    g_snprintf (spec, 8, "#%02x%02x%02x", r, g, b);
+}
+
+static GtkTextTag *
+create_tag (outview *out, guint32 style)
+{
+    GtkTextTag *tag;
+    guint       fg = ANSI_STYLE_FG (style),
+                bg = ANSI_STYLE_BG (style),
+                swap;
+    gchar       spec[8];
+
+    if (style & ANSI_STYLE_INVERSE) {
+        /* Default colors are assumed to be black on white */
+        fg   = fg ? fg : 1;
+        bg   = bg ? bg : 16;
+        swap = fg;
+        fg   = bg;
+        bg   = swap;
+    }
+
+    tag = gtk_text_buffer_create_tag (out->buffer, NULL, NULL);
+
+    if (fg) {
+        color_spec (fg - 1, spec);
+        g_object_set (tag, "foreground", spec, NULL);
+    }
+    if (bg) {
+        color_spec (bg - 1, spec);
+        g_object_set (tag, "background", spec, NULL);
+    }
+    if (style & ANSI_STYLE_BOLD) {
+        g_object_set (tag, "weight", PANGO_WEIGHT_BOLD, NULL);
+    }
+    if (style & ANSI_STYLE_FAINT) {
+        g_object_set (tag, "weight", PANGO_WEIGHT_LIGHT, NULL);
+    }
+    if (style & ANSI_STYLE_ITALIC) {
+        g_object_set (tag, "style", PANGO_STYLE_ITALIC, NULL);
+    }
+    if (style & ANSI_STYLE_UNDERLINE) {
+        g_object_set (tag, "underline", PANGO_UNDERLINE_SINGLE, NULL);
+    }
+
+    g_hash_table_insert (out->tags, GUINT_TO_POINTER (style), tag);
+    return tag;
+}
+
+static void
+insert_text (outview      *out,
+             GtkTextIter  *iter,
+             const gchar  *text,
+             gsize         len,
+             guint32       style)
+{
+    GtkTextTag *tag;
+
+    if (ANSI_STYLE_DEFAULT == style) {
+        gtk_text_buffer_insert (out->buffer, iter, text, len);
+        return;
+    }
+
+    tag = g_hash_table_lookup (out->tags, GUINT_TO_POINTER (style));
+    if (!tag) {
+        tag = create_tag (out, style);
+    }
+    gtk_text_buffer_insert_with_tags (out->buffer, iter, text, len,
+                                      tag, NULL);
+}
+
+/**
+ * Note the style of hidden text from offset on.
+ */
+static void
+fold_style (outview_fold *fold,
+            guint64       offset,
+            guint32       style)
+{
+    outview_span  span = { offset, style },
+                 *last;
+
+    if (fold->styles->len) {
+        last = &g_array_index (fold->styles, outview_span,
+                               fold->styles->len - 1);
+        if (last->style == style) {
+            return;
+        }
+        if (last->offset == offset) {
+            last->style = style;
+            return;
+        }
+    }
+    g_array_append_val (fold->styles, span);
+}
+
+/**
+ * Index of the style change in effect at offset.
+ */
+static guint
+fold_style_at (outview_fold *fold,
+               guint64       offset)
+{
+    guint lo = 0,
+          hi = fold->styles->len;
+
+    while (hi - lo > 1) {
+        guint mid = lo + (hi - lo) / 2;
+
+        if (g_array_index (fold->styles, outview_span, mid).offset <= offset) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/**
+ * Insert the hidden text of fold from offset from at iter, with its
+ * styles, up to to or OUTVIEW_EXPAND_PIECE bytes, whichever comes first.
+ * Returns the offset reached, which is on a character boundary.
+ */
+static guint64
+insert_range (outview       *out,
+              outview_fold  *fold,
+              guint64        from,
+              guint64        to,
+              GtkTextIter   *iter)
+{
+    transcript   *t   = out->transcript;
+    guint64       end = MIN (to, from + OUTVIEW_EXPAND_PIECE),
+                  next;
+    GString      *piece;
+    const guint8 *data;
+    outview_span *span;
+    gsize         done,
+                  n;
+    guint         i;
+
+    /* Stop short of a character cut by the piece size */
+    while (end < to && transcript_peek (t, end, to, &data)
+            && 0x80 == (*data & 0xc0)) {
+        --end;
+    }
+
+    /* The chunks may cut a character too */
+    piece = g_string_sized_new (end - from);
+    for (next = from; (n = transcript_peek (t, next, end, &data)); next += n) {
+        g_string_append_len (piece, (const gchar *) data, n);
+    }
+
+    for (i = fold_style_at (fold, from), done = 0; done < piece->len;
+         ++i, done += n) {
+        span = &g_array_index (fold->styles, outview_span, i);
+        next = i + 1 < fold->styles->len
+             ? g_array_index (fold->styles, outview_span, i + 1).offset
+             : end;
+        n    = MIN (piece->len - done, next - (from + done));
+        insert_text (out, iter, piece->str + done, n, span->style);
+    }
+
+    g_string_free (piece, TRUE);
+    return end;
+}
+
+/**
+ * Number of bytes of text that still fit into the head of the current
+ * response, and the number of lines among them.
+ */
+static gsize
+head_split (outview      *out,
+            const gchar  *text,
+            gsize         len,
+            guint        *lines)
+{
+    const gchar *p   = text,
+                *end = text + len,
+                *nl;
+    gsize        split,
+                 room;
+
+    *lines = 0;
+    while (p < end && out->resp_lines + *lines < OUTVIEW_FOLD_HEAD_LINES) {
+        nl = memchr (p, '\n', end - p);
+        if (!nl) {
+            p = end;
+            break;
+        }
+        p = nl + 1;
+        ++*lines;
+    }
+    split = p - text;
+
+    room  = OUTVIEW_FOLD_HEAD_BYTES - MIN (out->resp_bytes,
+                                           OUTVIEW_FOLD_HEAD_BYTES);
+    if (split > room) {
+        split = room;
+
+        /* Never cut a character in two */
+        while (split && 0x80 == (text[split] & 0xc0)) {
+            --split;
+        }
+    }
+    return split;
+}
+
+static void
+fold_begin (outview *out,
+            guint64  offset)
+{
+    outview_fold *fold = g_malloc0 (sizeof (outview_fold));
+
+    fold->start  = offset;
+    fold->end    = G_MAXUINT64;
+    fold->styles = g_array_new (FALSE, FALSE, sizeof (outview_span));
+    fold->marker = gtk_text_buffer_create_mark (out->buffer, NULL,
+                                                &out->iter, TRUE);
+
+    if (!gtk_text_iter_starts_line (&out->iter)) {
+        gtk_text_buffer_insert_with_tags (out->buffer, &out->iter, "\n", 1,
+                                          out->fold_tag, NULL);
+    }
+    gtk_text_buffer_insert_with_tags (out->buffer, &out->iter,
+                                      "[… output folded …]\n", -1,
+                                      out->fold_tag, NULL);
+
+    fold->resume = gtk_text_buffer_create_mark (out->buffer, NULL,
+                                                &out->iter, TRUE);
+
+    g_ptr_array_add (out->folds, fold);
+    out->active = fold;
+}
+
+static void
+fold_free (outview_fold *fold)
+{
+    g_array_free (fold->styles, TRUE);
+    g_free (fold);
+}
+
+static void
+fold_remove (outview      *out,
+             outview_fold *fold)
+{
+    gtk_text_buffer_delete_mark (out->buffer, fold->marker);
+    gtk_text_buffer_delete_mark (out->buffer, fold->resume);
+    g_ptr_array_remove (out->folds, fold);
+}
+
+/**
+ * Replace the marker text with a line saying text.
+ */
+static void
+fold_label (outview      *out,
+            outview_fold *fold,
+            const gchar  *text)
+{
+    GtkTextIter  start,
+                 end;
+    gchar       *label;
+
+    gtk_text_buffer_get_iter_at_mark (out->buffer, &start, fold->marker);
+    gtk_text_buffer_get_iter_at_mark (out->buffer, &end, fold->resume);
+    gtk_text_buffer_delete (out->buffer, &start, &end);
+
+    label = g_strconcat (gtk_text_iter_starts_line (&start) ? "" : "\n",
+                         text, "\n", NULL);
+    gtk_text_buffer_insert_with_tags (out->buffer, &start, label, -1,
+                                      out->fold_tag, NULL);
+    gtk_text_buffer_move_mark (out->buffer, fold->resume, &start);
+
+    g_free (label);
+}
+
+/**
+ * Transcript lines that fold still hides.
+ */
+static guint
+fold_hidden_lines (outview      *out,
+                   outview_fold *fold)
+{
+    return transcript_line_at (out->transcript, fold->end)
+         - transcript_line_at (out->transcript, fold->start);
+}
+
+/**
+ * The response has ended: show its last lines below the fold and label the
+ * marker with the amount of text hidden.
+ */
+static void
+fold_finish (outview *out)
+{
+    outview_fold *fold   = out->active;
+    transcript   *t      = out->transcript;
+    guint64       length = t->length,
+                  tail;
+    guint         last,
+                  hidden;
+    const guint8 *data;
+    GtkTextIter   start,
+                  end;
+    gchar        *size,
+                 *label;
+
+    out->active = NULL;
+
+    /* Start of the last few lines, within the tail byte budget */
+    last = transcript_line_at (t, length - 1);
+    tail = transcript_line_start (t, last >= OUTVIEW_FOLD_TAIL_LINES - 1
+                                     ? last - (OUTVIEW_FOLD_TAIL_LINES - 1)
+                                     : 0);
+    tail = MAX (tail, length - MIN (length, OUTVIEW_FOLD_TAIL_BYTES));
+    tail = MAX (tail, fold->start);
+    while (tail < length && transcript_peek (t, tail, length, &data)
+            && 0x80 == (*data & 0xc0)) {
+        ++tail;
+    }
+    fold->end = tail;
+
+    gtk_text_buffer_get_end_iter (out->buffer, &end);
+    while (tail < length) {
+        tail = insert_range (out, fold, tail, length, &end);
+    }
+
+    if (fold->end == fold->start) {
+        /* Everything fitted in the tail after all */
+        gtk_text_buffer_get_iter_at_mark (out->buffer, &start, fold->marker);
+        gtk_text_buffer_get_iter_at_mark (out->buffer, &end, fold->resume);
+        gtk_text_buffer_delete (out->buffer, &start, &end);
+        fold_remove (out, fold);
+        return;
+    }
+
+    hidden = fold_hidden_lines (out, fold);
+    size   = g_format_size (fold->end - fold->start);
+    label  = g_strdup_printf ("[… %u more line%s (%s), click to expand …]",
+                              hidden, 1 == hidden ? "" : "s", size);
+    fold_label (out, fold, label);
+
+    g_free (label);
+    g_free (size);
+}
+
+static void
+insert_run (const gchar  *text,
+            gsize         len,
+            guint32       style,
+            outview      *out)
+{
+    gsize split;
+    guint lines;
+
+    transcript_append (out->transcript, text, len);
+
+    if (out->active) {
+        /* Folded: the text only goes to the transcript */
+        fold_style (out->active, out->transcript->length - len, style);
+        return;
+    }
+
+    if (!out->in_command && !out->in_response) {
+        insert_text (out, &out->iter, text, len, style);
+        return;
+    }
+
+    split = head_split (out, text, len, &lines);
+    if (split) {
+        insert_text (out, &out->iter, text, split, style);
+        out->resp_lines += lines;
+        out->resp_bytes += split;
+    }
+    if (split < len) {
+        fold_begin (out, out->transcript->length - len + split);
+        fold_style (out->active, out->active->start, style);
+    }
+}
+
+static gboolean
+on_fold_event (GtkTextTag         G_GNUC_UNUSED *tag,
+               GObject            G_GNUC_UNUSED *object,
+               GdkEvent                         *event,
+               const GtkTextIter                *iter,
+               outview                          *out)
+{
+    outview_fold *fold;
+    GtkTextIter   start,
+                  end;
+    guint         i;
+
+    if (GDK_BUTTON_RELEASE != event->type || 1 != event->button.button) {
+        return FALSE;
+    }
+
+    for (i = 0; i < out->folds->len; ++i) {
+        fold = g_ptr_array_index (out->folds, i);
+
+        gtk_text_buffer_get_iter_at_mark (out->buffer, &start, fold->marker);
+        gtk_text_buffer_get_iter_at_mark (out->buffer, &end, fold->resume);
+
+        if (gtk_text_iter_in_range (iter, &start, &end)) {
+            outview_expand (out, fold);
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+outview *
+outview_new (GtkTextView *view)
+{
+    outview *out = g_malloc0 (sizeof (outview));
+
+    out->view   = view;
+    out->buffer = gtk_text_view_get_buffer (view);
+    out->tags   = g_hash_table_new (g_direct_hash, g_direct_equal);
+
+    out->transcript = transcript_new ();
+    out->folds      = g_ptr_array_new_with_free_func ((GDestroyNotify)
+                                                      fold_free);
+    out->fold_tag   = gtk_text_buffer_create_tag (out->buffer, NULL,
+                                                  "foreground", "#75507b",
+                                                  "style", PANGO_STYLE_ITALIC,
+                                                  NULL);
+
+    g_signal_connect (G_OBJECT (out->fold_tag), "event",
+                      G_CALLBACK (on_fold_event), out);
+
+    ansi_parser_init (&out->parser);
+    g_queue_init (&out->expanding);
+
+    return out;
+}
+
+/**
+ * Append output to the end of the view. ANSI escape sequences are removed
+ * and SGR attributes are applied through a cache of tags, one per distinct
+ * style, so each run of text is inserted with a single call.
+ */
+void
+outview_append (outview      *out,
+                const gchar  *data,
+                gsize         len)
+{
+    TRACE_BEGIN ("outview_append");
+
+    gtk_text_buffer_get_end_iter (out->buffer, &out->iter);
+    ansi_parser_feed (&out->parser, data, len,
+                      (ansi_text_func) insert_run, out);
+
+    TRACE_END ("outview_append");
+}
+
+/**
+ * Start of a command: the echoed input is appended next, and is folded if
+ * it is too large to show at once.
+ */
+void
+outview_begin_command (outview *out)
+{
+    if (out->in_command || out->in_response) {
+        /* The previous command never reached its prompt */
+        outview_end_command (out);
+    }
+    transcript_begin_command (out->transcript);
+
+    /* A large paste is folded like a large response */
+    out->in_command = TRUE;
+    out->resp_lines = 0;
+    out->resp_bytes = 0;
+}
+
+/**
+ * Everything appended from now until outview_end_command () is the
+ * command's response, and is folded if it grows too large.
+ */
+void
+outview_begin_output (outview *out)
+{
+    if (out->active) {
+        /* The end of the echo goes below its fold */
+        fold_finish (out);
+    }
+    transcript_begin_output (out->transcript);
+
+    out->in_command  = FALSE;
+    out->in_response = TRUE;
+    out->resp_lines  = 0;
+    out->resp_bytes  = 0;
+}
+
+void
+outview_end_command (outview *out)
+{
+    if (out->active) {
+        fold_finish (out);
+    }
+    out->in_command  = FALSE;
+    out->in_response = FALSE;
+
+    transcript_end_command (out->transcript);
+}
+
+/**
+ * Insert the next piece of the fold being opened in front of its marker,
+ * which moves along and shows what is left until the text is all there.
+ */
+static gboolean
+expand_step (outview *out)
+{
+    outview_fold *fold = g_queue_peek_head (&out->expanding);
+    GtkTextIter   start,
+                  end;
+    guint         hidden;
+    gchar        *label;
+
+    TRACE_BEGIN ("outview.expand_step");
+
+    gtk_text_buffer_get_iter_at_mark (out->buffer, &start, fold->marker);
+    fold->start = insert_range (out, fold, fold->start, fold->end, &start);
+    gtk_text_buffer_move_mark (out->buffer, fold->marker, &start);
+
+    if (fold->start < fold->end) {
+        hidden = fold_hidden_lines (out, fold);
+        label  = g_strdup_printf ("[… expanding, %u more line%s …]",
+                                  hidden, 1 == hidden ? "" : "s");
+        fold_label (out, fold, label);
+        g_free (label);
+
+        TRACE_END ("outview.expand_step");
+        return G_SOURCE_CONTINUE;
+    }
+
+    gtk_text_buffer_get_iter_at_mark (out->buffer, &end, fold->resume);
+    gtk_text_buffer_delete (out->buffer, &start, &end);
+    fold_remove (out, fold);
+    g_queue_pop_head (&out->expanding);
+
+    if (out->expanded) {
+        out->expanded (out, out->expanded_data);
+    }
+
+    TRACE_END ("outview.expand_step");
+
+    if (g_queue_is_empty (&out->expanding)) {
+        out->expand_idle = 0;
+        return G_SOURCE_REMOVE;
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+/**
+ * Replace a fold's marker with the text it hides. Large folds take a
+ * while, so the text goes in a piece at a time from an idle handler.
+ */
+void
+outview_expand (outview      *out,
+                outview_fold *fold)
+{
+    if (fold == out->active || g_queue_find (&out->expanding, fold)) {
+        /* Still receiving output, or already opening */
+        return;
+    }
+
+    g_queue_push_tail (&out->expanding, fold);
+    if (!out->expand_idle) {
+        out->expand_idle = g_idle_add ((GSourceFunc) expand_step, out);
+    }
+}
+
+/**
+ * Have func called each time a fold has been opened.
+ */
+void
+outview_set_expand_func (outview             *out,
+                         outview_expand_func  func,
+                         gpointer             user_data)
+{
+    out->expanded      = func;
+    out->expanded_data = user_data;
+}
+
+static void
+map_from (outview            *out,
+          guint64             base,
+          const GtkTextIter  *base_iter,
+          guint64             offset,
+          GtkTextIter        *iter)
+{
+    transcript   *t  = out->transcript;
+    guint         bl = transcript_line_at (t, base),
+                  ol = transcript_line_at (t, offset);
+    const guint8 *data;
+    gsize         n,
+                  i;
+    gint          chars = 0,
+                  bytes;
+
+    *iter = *base_iter;
+
+    if (bl == ol) {
+        /* Same line: count the characters in between */
+        while ((n = transcript_peek (t, base, offset, &data))) {
+            for (i = 0; i < n; ++i) {
+                chars += 0x80 != (data[i] & 0xc0);
+            }
+            base += n;
+        }
+        gtk_text_iter_forward_chars (iter, chars);
+        return;
+    }
+
+    gtk_text_buffer_get_iter_at_line (out->buffer, iter,
+                                      gtk_text_iter_get_line (base_iter)
+                                      + (ol - bl));
+    bytes = gtk_text_iter_get_bytes_in_line (iter);
+    gtk_text_iter_set_line_index (iter,
+                                  MIN (offset - transcript_line_start (t, ol),
+                                       (guint64) MAX (bytes - 1, 0)));
+}
+
+/**
+ * Buffer position of a transcript offset. Offsets hidden by a fold map to
+ * its marker and FALSE is returned; with expand set the fold starts to
+ * open, and the expand func is called once it has.
+ */
+gboolean
+outview_offset_to_iter (outview      *out,
+                        guint64       offset,
+                        gboolean      expand,
+                        GtkTextIter  *iter)
+{
+    outview_fold *fold;
+    GtkTextIter   base;
+    guint         i;
+
+    for (i = out->folds->len; i-- > 0; ) {
+        fold = g_ptr_array_index (out->folds, i);
+
+        if (fold->start > offset) {
+            continue;
+        }
+
+        if (offset < fold->end) {
+            if (expand) {
+                outview_expand (out, fold);
+            }
+            gtk_text_buffer_get_iter_at_mark (out->buffer, iter,
+                                              fold->marker);
+            return FALSE;
+        }
+
+        /* Past the fold the buffer follows the transcript again */
+        gtk_text_buffer_get_iter_at_mark (out->buffer, &base, fold->resume);
+        map_from (out, fold->end, &base, offset, iter);
+        return TRUE;
+    }
+
+    gtk_text_buffer_get_start_iter (out->buffer, &base);
+    map_from (out, 0, &base, offset, iter);
+    return TRUE;
+}
+
+void
+outview_free (outview *out)
+{
+    if (out->expand_idle) {
+        g_source_remove (out->expand_idle);
+    }
+    g_queue_clear (&out->expanding);
+
+    /* The tags themselves belong to the buffer's tag table */
+    g_hash_table_destroy (out->tags);
+    transcript_unref (out->transcript);
+    g_ptr_array_free (out->folds, TRUE);
+    g_free (out);
+}
@@ -0,0 +1,75 @@
+#ifndef OUTVIEW_H
+#define OUTVIEW_H
+
+#include <gtk/gtk.h>
+#include "ansi.h"
+#include "transcript.h"
+
+G_BEGIN_DECLS
+
+/* A response, or the echo of a large paste, is folded once it goes past
+ * the head limits; at the end only the last lines are shown below the
+ * fold. */
+#define OUTVIEW_FOLD_HEAD_LINES   200
+#define OUTVIEW_FOLD_HEAD_BYTES   (64 * 1024)
+#define OUTVIEW_FOLD_TAIL_LINES   20
+#define OUTVIEW_FOLD_TAIL_BYTES   (8 * 1024)
+#define OUTVIEW_EXPAND_PIECE      (256 * 1024)     /* Inserted per idle */
+
+typedef struct _outview outview;
+typedef struct _outview_fold outview_fold;
+
+typedef void (*outview_expand_func) (outview *out, gpointer user_data);
+
+/* Output held back from the buffer. The text itself stays in the
+ * transcript; the buffer only holds a marker between two marks. */
+struct _outview_fold
+{
+    guint64        start,       /* Hidden transcript range. end is */
+                   end;         /* G_MAXUINT64 while output arrives. */
+    GtkTextMark   *marker,      /* Start of the marker text */
+                  *resume;      /* Where the buffer follows the transcript
+                                 * again, from offset end onwards */
+    GArray        *styles;      /* outview_span, where the ANSI style of
+                                 * the hidden text changes */
+};
+
+struct _outview
+{
+    GtkTextView   *view;
+    GtkTextBuffer *buffer;
+    ansi_parser    parser;
+    GHashTable    *tags;        /* Packed ANSI style -> GtkTextTag */
+    GtkTextIter    iter;        /* Insertion point while appending */
+    transcript    *transcript;  /* All output, including folded text */
+
+    GPtrArray     *folds;       /* Collapsed outview_folds, by offset */
+    outview_fold  *active;      /* Fold currently swallowing output */
+    GtkTextTag    *fold_tag;
+    gboolean       in_command,  /* The input is being echoed */
+                   in_response;
+    guint          resp_lines;  /* Shown so far of the current echo or
+                                 * response */
+    gsize          resp_bytes;
+
+    GQueue         expanding;   /* Folds being opened, a piece per idle */
+    guint          expand_idle;
+    outview_expand_func expanded; /* Called as each fold is open */
+    gpointer       expanded_data;
+};
+
+outview *outview_new    (GtkTextView *view);
+void     outview_append (outview *out, const gchar *data, gsize len);
+void     outview_begin_command  (outview *out);
+void     outview_begin_output   (outview *out);
+void     outview_end_command    (outview *out);
+void     outview_expand         (outview *out, outview_fold *fold);
+void     outview_set_expand_func (outview *out, outview_expand_func func,
+                                  gpointer user_data);
+gboolean outview_offset_to_iter (outview *out, guint64 offset,
+                                 gboolean expand, GtkTextIter *iter);
+void     outview_free   (outview *out);
+
+G_END_DECLS
+
+#endif /* OUTVIEW_H */
@@ -1,21 +1,182 @@
 #include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include "processio.h"
+#include "trace.h"
+
+struct _pio_replay
+{
+    pio_recorder *reader;
+    pio_record    next;
+    gboolean      pending,      /* next holds a record not yet fed */
+                  fast,         /* Ignore the recorded timing */
+                  running,      /* Inside the read callback */
+                  stopped;
+    gint64        start;
+    guint64       bytes;
+    guint         source;
+};
+
+#define REMOTE_READ_SIZE 65536
+
+struct _pio_remote
+{
+    GByteArray   *frames;       /* Received bytes not yet dispatched */
+    gboolean      stopped;      /* Connection shut down by processio_kill */
+};
+
+static gboolean
+on_channel_readable (GIOChannel     *channel,
+                     GIOCondition    cond,
+                     pio_env        *env)
+{
+    gsize          bytes;
+    GByteArray    *read_buf;
+    pio_stream     stream;
+
+    if (cond == G_IO_HUP) {
+        return FALSE;
+    }
+
+    if (env->io_out == channel) {
+        stream   = PIO_STREAM_OUT;
+        read_buf = env->read_out;
+    } else {
+        stream   = PIO_STREAM_ERR;
+        read_buf = env->read_err;
+    }
+
+    if (G_IO_STATUS_ERROR == g_io_channel_read_chars (channel,
+                                  (gchar *) read_buf->data,
+                                  READ_BUF_SIZE, &bytes, NULL))
+    {
+        return FALSE;
+    }
+
+    if (bytes && env->recorder) {
+        recorder_write (env->recorder, stream, read_buf->data, bytes);
+    }
+
+    env->read_func (stream, read_buf->data, bytes, env->read_data);
+
+    return TRUE;
+}
 
 static void
 setup_listener (GIOChannel  *channel,
                 GSource    **source,
                 GSourceFunc  callback,
-                gpointer     data)
+                pio_env     *env)
 {
+    TRACE_BEGIN ("setup_listener");
+
     g_io_channel_set_flags (channel, G_IO_FLAG_NONBLOCK, NULL);
 
     *source = g_io_create_watch (channel, G_IO_IN | G_IO_HUP);
+    g_source_set_priority (*source, env->priority);
 
     /* Add the GSource to default context */
     g_source_attach (*source, NULL);
-    g_source_set_callback (*source, callback, data, NULL);
+    g_source_set_callback (*source, callback, env, NULL);
+
+    TRACE_END ("setup_listener");
+}
+
+static void
+write_queue_clear (pio_env *env)
+{
+    g_queue_foreach (&env->write_queue, (GFunc) g_bytes_unref, NULL);
+    g_queue_clear (&env->write_queue);
+
+    env->write_offset = 0;
+    env->queued       = 0;
+}
+
+/**
+ * Write as much of the queue as the pipe accepts without blocking. Returns
+ * TRUE if data remains queued.
+ */
+static gboolean
+write_queue_flush (pio_env *env)
+{
+    GBytes      *head;
+    const gchar *data;
+    gsize        size,
+                 written;
+    GIOStatus    status;
+
+    while ((head = g_queue_peek_head (&env->write_queue))) {
+        data   = g_bytes_get_data (head, &size);
+        status = g_io_channel_write_chars (env->io_in,
+                                           data + env->write_offset,
+                                           size - env->write_offset,
+                                           &written, NULL);
+
+        env->write_offset += written;
+        env->queued       -= written;
+
+        if (env->write_offset == size) {
+            g_bytes_unref (g_queue_pop_head (&env->write_queue));
+            env->write_offset = 0;
+        } else if (G_IO_STATUS_ERROR == status) {
+            g_warning ("Write to ghci failed, dropping %" G_GSIZE_FORMAT
+                       " queued bytes", env->queued);
+            write_queue_clear (env);
+        } else {
+            /* Pipe is full */
+            break;
+        }
+    }
+
+    if (env->queue_func) {
+        env->queue_func (env, env->queued, env->queue_data);
+    }
+
+    return NULL != head;
+}
+
+static gboolean
+on_channel_writable (GIOChannel   G_GNUC_UNUSED *channel,
+                     GIOCondition               cond,
+                     pio_env                   *env)
+{
+    if (cond & (G_IO_ERR | G_IO_HUP) || !write_queue_flush (env)) {
+        env->src_in = NULL;
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/**
+ * Queue data for the child's stdin, and start writing it.
+ */
+static void
+write_queue_push (pio_env      *env,
+                  const gchar  *data,
+                  gsize         len)
+{
+    if (!env->io_in) {
+        return;
+    }
+
+    g_queue_push_tail (&env->write_queue, g_bytes_new (data, len));
+    env->queued += len;
+
+    if (!env->src_in && write_queue_flush (env)) {
+        /* Write the rest once the child has read some of its input */
+        env->src_in = g_io_create_watch (env->io_in,
+                                         G_IO_OUT | G_IO_ERR | G_IO_HUP);
+        g_source_set_callback (env->src_in, (GSourceFunc) on_channel_writable,
+                               env, NULL);
+        g_source_set_priority (env->src_in, env->priority);
+        g_source_attach (env->src_in, NULL);
+        g_source_unref (env->src_in);
+    }
 }
 
 static void
@@ -29,6 +190,52 @@ destroy_listener (GIOChannel  *channel,
     g_io_channel_unref (channel);
 }
 
+/**
+ * Allocate an environment for a session shown in window (or NULL when
+ * headless), to be passed to one of the processio_*_init functions.
+ */
+pio_env *
+processio_env_new (GtkWidget *window)
+{
+    pio_env *env = g_malloc0 (sizeof (pio_env));
+
+    env->window   = window;
+    env->priority = G_PRIORITY_DEFAULT;
+    env->nice     = 5;
+    env->read_out = g_byte_array_sized_new (READ_BUF_SIZE);
+    env->read_err = g_byte_array_sized_new (READ_BUF_SIZE);
+    env->buffer   = g_byte_array_new ();
+
+    return env;
+}
+
+/**
+ * Release an environment, calling its exit function and destroying its
+ * window. Used by the backends once the session is over, and directly for
+ * an environment that was never started.
+ */
+void
+processio_env_free (pio_env *env)
+{
+    if (env->recorder) {
+        recorder_close (env->recorder);
+    }
+
+    if (env->exit_func) {
+        env->exit_func (env, env->exit_data);
+    }
+
+    /* Destroy app window, if there is one */
+    if (env->window) {
+        gtk_widget_destroy (env->window);
+    }
+
+    g_byte_array_free (env->read_out, TRUE);
+    g_byte_array_free (env->read_err, TRUE);
+    g_byte_array_free (env->buffer, TRUE);
+    g_free (env);
+}
+
 static void
 processio_cleanup (GPid                    pid,
                    gint     G_GNUC_UNUSED  status,
@@ -36,24 +243,269 @@ processio_cleanup (GPid                    pid,
 {
     destroy_listener (env->io_out, env->src_out);
     destroy_listener (env->io_err, env->src_err);
-    destroy_listener (env->io_in, NULL);
+    destroy_listener (env->io_in, env->src_in);
+    write_queue_clear (env);
 
     /* Close process, for cross-platform support */
     g_spawn_close_pid (pid);
 
-    /* Destroy app window */
-    gtk_widget_destroy (env->window);
+    processio_env_free (env);
+}
 
-    g_byte_array_free (env->read_out, TRUE);
-    g_byte_array_free (env->read_err, TRUE);
-    g_byte_array_free (env->buffer, TRUE);
-    g_free (env);
+static void
+replay_free (pio_env *env)
+{
+    pio_replay *replay = env->replay;
+
+    if (replay->source) {
+        g_source_remove (replay->source);
+    }
+    recorder_close (replay->reader);
+    g_free (replay);
+
+    processio_env_free (env);
+}
+
+static gboolean
+replay_step (pio_env *env)
+{
+    pio_replay *replay = env->replay;
+    gint64      elapsed,
+                delay;
+
+    for (;;) {
+        if (!replay->pending) {
+            if (!record_reader_next (replay->reader, &replay->next)) {
+                elapsed = g_get_monotonic_time () - replay->start;
+                g_message ("Replay finished: %" G_GUINT64_FORMAT " bytes in %.1f ms",
+                           replay->bytes, elapsed / 1000.0);
+
+                replay->source = 0;
+                return G_SOURCE_REMOVE;
+            }
+            replay->pending = TRUE;
+        }
+
+        if (!replay->fast) {
+            elapsed = g_get_monotonic_time () - replay->start;
+            delay   = replay->next.timestamp - elapsed;
+
+            if (delay > 0) {
+                /* Wait until the chunk's original arrival time */
+                replay->source = g_timeout_add (MAX (1, delay / 1000),
+                                                (GSourceFunc) replay_step,
+                                                env);
+                return G_SOURCE_REMOVE;
+            }
+        }
+
+        replay->pending = FALSE;
+
+        if (PIO_STREAM_IN == replay->next.stream) {
+            /* Writes to stdin are only logged for reference */
+            continue;
+        }
+
+        replay->bytes  += replay->next.length;
+        replay->running = TRUE;
+        env->read_func (replay->next.stream, replay->next.data,
+                        replay->next.length, env->read_data);
+        replay->running = FALSE;
+
+        if (replay->stopped) {
+            /* Window was closed from within the read callback */
+            replay->source = 0;
+            replay_free (env);
+            return G_SOURCE_REMOVE;
+        }
+
+        if (replay->fast) {
+            /* One chunk per idle iteration */
+            return G_SOURCE_CONTINUE;
+        }
+    }
+}
+
+static void
+pipe_write (pio_env      *env,
+            const gchar  *data,
+            gsize         len)
+{
+    write_queue_push (env, data, len);
+}
+
+static gboolean
+pipe_interrupt (pio_env *env)
+{
+    return !kill (env->pid, SIGINT);
+}
+
+static void
+pipe_kill (pio_env *env)
+{
+    if (!kill (env->pid, SIGKILL)) {
+        g_message ("SIGKILL");
+    }
+}
+
+static const pio_backend pipe_backend =
+{
+    pipe_write,
+    pipe_interrupt,
+    pipe_kill
+};
+
+static void
+replay_write (pio_env      G_GNUC_UNUSED *env,
+              const gchar  G_GNUC_UNUSED *data,
+              gsize        G_GNUC_UNUSED  len)
+{
+    /* Input to a recording goes nowhere */
+}
+
+static gboolean
+replay_interrupt (pio_env G_GNUC_UNUSED *env)
+{
+    return FALSE;
+}
+
+static void
+replay_kill (pio_env *env)
+{
+    env->replay->stopped = TRUE;
+    if (!env->replay->running) {
+        replay_free (env);
+    }
+}
+
+static const pio_backend replay_backend =
+{
+    replay_write,
+    replay_interrupt,
+    replay_kill
+};
+
+static void
+remote_write (pio_env      *env,
+              const gchar  *data,
+              gsize         len)
+{
+    gsize n;
+
+    do {
+        n = MIN (len, PIO_FRAME_MAX);
+        processio_send (env, PIO_STREAM_IN, (const guint8 *) data, n);
+        data += n;
+        len  -= n;
+    } while (len);
+}
+
+static gboolean
+remote_interrupt (pio_env *env)
+{
+    processio_send (env, PIO_FRAME_INTERRUPT, NULL, 0);
+    return TRUE;
+}
+
+static void
+remote_kill (pio_env *env)
+{
+    /* The watch sees the end of the stream and cleans up */
+    env->remote->stopped = TRUE;
+    shutdown (g_io_channel_unix_get_fd (env->io_in), SHUT_RDWR);
+}
+
+static const pio_backend remote_backend =
+{
+    remote_write,
+    remote_interrupt,
+    remote_kill
+};
+
+static void
+remote_cleanup (pio_env *env)
+{
+    /* Both directions share one channel */
+    if (env->src_in) {
+        g_source_destroy (env->src_in);
+    }
+    destroy_listener (env->io_out, env->src_out);
+    write_queue_clear (env);
+
+    g_byte_array_free (env->remote->frames, TRUE);
+    g_free (env->remote);
+
+    processio_env_free (env);
+}
+
+/**
+ * Read from a daemon connection and pass every complete frame to the read
+ * callback.
+ */
+static gboolean
+on_socket_readable (GIOChannel   *channel,
+                    GIOCondition  G_GNUC_UNUSED cond,
+                    pio_env      *env)
+{
+    pio_remote *remote = env->remote;
+    GByteArray *frames = remote->frames;
+    guint       old    = frames->len,
+                offset = 0;
+    guint32     len;
+    gsize       bytes  = 0;
+    GIOStatus   status;
+    guint8     *frame;
+
+    g_byte_array_set_size (frames, old + REMOTE_READ_SIZE);
+    status = g_io_channel_read_chars (channel, (gchar *) frames->data + old,
+                                      REMOTE_READ_SIZE, &bytes, NULL);
+    g_byte_array_set_size (frames, old + bytes);
+
+    if (G_IO_STATUS_ERROR == status || G_IO_STATUS_EOF == status) {
+        remote_cleanup (env);
+        return FALSE;
+    }
+
+    while (!remote->stopped && frames->len - offset >= PIO_FRAME_HEADER) {
+        frame = frames->data + offset;
+        memcpy (&len, frame + 1, sizeof (len));
+        len   = GUINT32_FROM_LE (len);
+
+        if (len > PIO_FRAME_MAX) {
+            g_warning ("Malformed frame on daemon connection");
+            remote_kill (env);
+            break;
+        }
+        if (frames->len - offset < PIO_FRAME_HEADER + len) {
+            break;
+        }
+
+        if (env->recorder && (PIO_STREAM_OUT == frame[0]
+                              || PIO_STREAM_ERR == frame[0])) {
+            recorder_write (env->recorder, frame[0],
+                            frame + PIO_FRAME_HEADER, len);
+        }
+
+        env->read_func (frame[0], frame + PIO_FRAME_HEADER, len,
+                        env->read_data);
+
+        offset += PIO_FRAME_HEADER + len;
+    }
+
+    if (remote->stopped) {
+        /* Anything still arriving is of no interest */
+        g_byte_array_set_size (frames, 0);
+    } else {
+        g_byte_array_remove_range (frames, 0, offset);
+    }
+
+    return TRUE;
 }
 
 gboolean
 processio_init (char          *argv[],
                 pio_env      **io_env,
-                GSourceFunc    callback,
+                pio_read_func  callback,
                 gpointer       data)
 {
     GError     *error   = NULL;
@@ -92,7 +544,7 @@ processio_init (char          *argv[],
     }
 
     /* Assign a lower process scheduling priority */
-    if (!setpriority (PRIO_PROCESS, pid, 5)) {
+    if (!setpriority (PRIO_PROCESS, pid, (*io_env)->nice)) {
         g_message ("Changed process priority");
     }
 
@@ -114,16 +566,342 @@ processio_init (char          *argv[],
     io_in  = g_io_channel_unix_new (in);
 #endif
 
-    setup_listener (io_out, &src_out, callback, data);
-    setup_listener (io_err, &src_err, callback, data);
+    (*io_env)->read_func = callback;
+    (*io_env)->read_data = data;
+
+    /* Output is passed on as raw bytes, invalid UTF-8 included; the reader
+     * validates it (see utf8.c) */
+    g_io_channel_set_encoding (io_out, NULL, NULL);
+    g_io_channel_set_buffered (io_out, FALSE);
+    g_io_channel_set_encoding (io_err, NULL, NULL);
+    g_io_channel_set_buffered (io_err, FALSE);
+
+    /* Writes to stdin are queued and never block */
+    g_io_channel_set_encoding (io_in, NULL, NULL);
+    g_io_channel_set_buffered (io_in, FALSE);
+    g_io_channel_set_flags (io_in, G_IO_FLAG_NONBLOCK, NULL);
+
+    setup_listener (io_out, &src_out, (GSourceFunc) on_channel_readable, *io_env);
+    setup_listener (io_err, &src_err, (GSourceFunc) on_channel_readable, *io_env);
 
     (*io_env)->io_out    = io_out;
     (*io_env)->io_err    = io_err;
     (*io_env)->io_in     = io_in;
-    (*io_env)->active    = NULL;
+    (*io_env)->active    = PIO_STREAM_NONE;
     (*io_env)->src_out   = src_out;
     (*io_env)->src_err   = src_err;
     (*io_env)->pid       = pid;
+    (*io_env)->backend   = &pipe_backend;
+
+    return TRUE;
+}
+
+/**
+ * Run a session over a connected stream socket. Every message is a frame
+ * of PIO_FRAME_HEADER bytes (type, then payload length) and the payload;
+ * received frames are passed to the read callback with the frame type as
+ * the stream. The daemon uses this for its clients as well.
+ */
+gboolean
+processio_socket_init (gint            fd,
+                       pio_env       **io_env,
+                       pio_read_func   callback,
+                       gpointer        data)
+{
+    GIOChannel *channel = g_io_channel_unix_new (fd);
+    pio_remote *remote  = g_malloc0 (sizeof (pio_remote));
+
+    remote->frames = g_byte_array_new ();
+
+    g_io_channel_set_encoding (channel, NULL, NULL);
+    g_io_channel_set_buffered (channel, FALSE);
+
+    (*io_env)->read_func = callback;
+    (*io_env)->read_data = data;
+    (*io_env)->remote    = remote;
+
+    setup_listener (channel, &(*io_env)->src_out,
+                    (GSourceFunc) on_socket_readable, *io_env);
+
+    (*io_env)->io_out    = channel;
+    (*io_env)->io_in     = channel;
+    (*io_env)->active    = PIO_STREAM_NONE;
+    (*io_env)->pid       = 0;
+    (*io_env)->backend   = &remote_backend;
+
+    return TRUE;
+}
+
+/**
+ * Attach to a session hosted by a daemon listening on the Unix socket at
+ * path (see daemon.c): the ghci shared under the name share, or one of
+ * its own if share is NULL.
+ */
+gboolean
+processio_connect (const gchar    *path,
+                   const gchar    *share,
+                   pio_env       **io_env,
+                   pio_read_func   callback,
+                   gpointer        data,
+                   GError        **error)
+{
+    struct sockaddr_un addr;
+    gint               fd;
+
+    memset (&addr, 0, sizeof (addr));
+    addr.sun_family = AF_UNIX;
+
+    if (strlen (path) >= sizeof (addr.sun_path)) {
+        g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_NAMETOOLONG,
+                     "%s: Socket path too long", path);
+        return FALSE;
+    }
+    strcpy (addr.sun_path, path);
+
+    fd = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect (fd, (struct sockaddr *) &addr, sizeof (addr))) {
+        g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+                     "%s: %s", path, g_strerror (errno));
+        if (fd >= 0) {
+            close (fd);
+        }
+        return FALSE;
+    }
+
+    /* A daemon going away shows up as a failed write, not a signal */
+    signal (SIGPIPE, SIG_IGN);
+
+    processio_socket_init (fd, io_env, callback, data);
+    processio_send (*io_env, PIO_FRAME_SESSION, (const guint8 *) share,
+                    share ? strlen (share) : 0);
+
+    return TRUE;
+}
+
+/**
+ * Feed a session recording through the read callback in place of a live
+ * child process. With fast set, chunks are delivered as quickly as the
+ * callback consumes them; otherwise at their original timing.
+ */
+gboolean
+processio_replay_init (const gchar    *path,
+                       gboolean        fast,
+                       pio_env       **io_env,
+                       pio_read_func   callback,
+                       gpointer        data,
+                       GError        **error)
+{
+    pio_replay   *replay;
+    pio_recorder *reader;
+
+    reader = record_reader_open (path, error);
+    if (!reader) {
+        return FALSE;
+    }
+
+    replay         = g_malloc0 (sizeof (pio_replay));
+    replay->reader = reader;
+    replay->fast   = fast;
+    replay->start  = g_get_monotonic_time ();
+
+    (*io_env)->read_func = callback;
+    (*io_env)->read_data = data;
+    (*io_env)->active    = PIO_STREAM_NONE;
+    (*io_env)->replay    = replay;
+    (*io_env)->pid       = 0;
+    (*io_env)->backend   = &replay_backend;
+
+    if (fast) {
+        replay->source = g_idle_add ((GSourceFunc) replay_step, *io_env);
+    } else {
+        replay->source = g_timeout_add (0, (GSourceFunc) replay_step, *io_env);
+    }
+
+    return TRUE;
+}
+
+/**
+ * Log every chunk read from, and written to, the child to path.
+ */
+gboolean
+processio_record (pio_env      *env,
+                  const gchar  *path,
+                  GError      **error)
+{
+    pio_recorder *rec = recorder_open (path, error);
+
+    if (!rec) {
+        return FALSE;
+    }
+    if (env->recorder) {
+        recorder_close (env->recorder);
+    }
+    env->recorder = rec;
 
     return TRUE;
 }
+
+void
+processio_write (pio_env      *env,
+                 const gchar  *data,
+                 gssize        len)
+{
+    if (len < 0) {
+        len = strlen (data);
+    }
+
+    if (env->recorder) {
+        recorder_write (env->recorder, PIO_STREAM_IN, (const guint8 *) data, len);
+    }
+
+    if (len) {
+        env->backend->write (env, data, len);
+    }
+}
+
+/**
+ * Queue a frame on a socket session.
+ */
+void
+processio_send (pio_env       *env,
+                pio_stream     type,
+                const guint8  *data,
+                gsize          len)
+{
+    guint8  header[PIO_FRAME_HEADER];
+    guint32 n = GUINT32_TO_LE (len);
+
+    g_return_if_fail (env->remote && len <= PIO_FRAME_MAX);
+
+    header[0] = type;
+    memcpy (header + 1, &n, sizeof (n));
+
+    write_queue_push (env, (const gchar *) header, PIO_FRAME_HEADER);
+    if (len) {
+        write_queue_push (env, (const gchar *) data, len);
+    }
+}
+
+/**
+ * Send a command typed or pasted by the user. Multi-line input is wrapped in
+ * a :{ ... :} block so that ghci reads it as a single command.
+ */
+void
+processio_submit (pio_env      *env,
+                  const gchar  *text)
+{
+    gsize len = strlen (text);
+
+    while (len && '\n' == text[len - 1]) {
+        --len;
+    }
+
+    if (memchr (text, '\n', len) && !g_str_has_prefix (text, ":{")) {
+        processio_write (env, ":{\n", -1);
+        processio_write (env, text, len);
+        processio_write (env, "\n:}\n", -1);
+    } else {
+        processio_write (env, text, len);
+        processio_write (env, "\n", 1);
+    }
+}
+
+/**
+ * Number of bytes of stdout data up to the end of the first prompt in it,
+ * which may have begun in the last tlen bytes before it, tail; 0 if no
+ * prompt ends in data. Commands sent ahead make ghci print a prompt and
+ * carry on, so a prompt need not end a read.
+ */
+gsize
+processio_prompt_end (const guint8  *tail,
+                      guint          tlen,
+                      const guint8  *data,
+                      gsize          bytes)
+{
+    const guint8 *p,
+                 *end = data + bytes;
+    gsize         k;
+
+    /* The first k bytes of the prompt are at the end of the tail */
+    for (k = MIN (tlen, TAIL_SIZE - 1); k; --k) {
+        if (bytes >= TAIL_SIZE - k
+                && !memcmp (tail + tlen - k, TAIL_STRING, k)
+                && !memcmp (data, TAIL_STRING + k, TAIL_SIZE - k)) {
+            return TAIL_SIZE - k;
+        }
+    }
+
+    for (p = data; (p = memchr (p, TAIL_STRING[0], end - p)); ++p) {
+        if ((gsize) (end - p) < TAIL_SIZE) {
+            break;
+        }
+        if (!memcmp (p, TAIL_STRING, TAIL_SIZE)) {
+            return p - data + TAIL_SIZE;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Number of bytes still waiting to be written to the child's stdin.
+ */
+gsize
+processio_get_queued (pio_env *env)
+{
+    return env->queued;
+}
+
+static void
+discard_read (pio_stream G_GNUC_UNUSED  stream,
+              guint8     G_GNUC_UNUSED *data,
+              gsize      G_GNUC_UNUSED  bytes,
+              gpointer   G_GNUC_UNUSED  user_data)
+{
+}
+
+/**
+ * Put env in old's place: env takes over old's window, callbacks and
+ * recording, and old is terminated with whatever it still has to say
+ * discarded.
+ */
+void
+processio_replace (pio_env *old,
+                   pio_env *env)
+{
+    env->window     = old->window;
+    env->read_func  = old->read_func;
+    env->read_data  = old->read_data;
+    env->queue_func = old->queue_func;
+    env->queue_data = old->queue_data;
+    env->exit_func  = old->exit_func;
+    env->exit_data  = old->exit_data;
+    env->recorder   = old->recorder;
+
+    old->window     = NULL;
+    old->read_func  = discard_read;
+    old->queue_func = NULL;
+    old->exit_func  = NULL;
+    old->recorder   = NULL;
+
+    processio_kill (old);
+}
+
+/**
+ * Send SIGINT to the child. Returns FALSE if there is no child to
+ * interrupt.
+ */
+gboolean
+processio_interrupt (pio_env *env)
+{
+    return env->backend->interrupt (env);
+}
+
+/**
+ * Terminate the session. The environment, and the window it belongs to, are
+ * released once the child has exited.
+ */
+void
+processio_kill (pio_env *env)
+{
+    env->backend->kill (env);
+}
@@ -2,6 +2,7 @@
 #define PROCESSIO_H
 
 #include <gtk/gtk.h>
+#include "record.h"
 
 G_BEGIN_DECLS
 
@@ -9,28 +10,117 @@ G_BEGIN_DECLS
 #define TAIL_STRING "Prelude> "
 #define READ_BUF_SIZE 1024
 
+/* Frames on a daemon connection: type byte, little-endian payload length */
+#define PIO_FRAME_HEADER 5
+#define PIO_FRAME_MAX    (16 * 1024 * 1024)
+
+typedef enum {
+    PIO_STREAM_NONE = 0,
+    PIO_STREAM_OUT,
+    PIO_STREAM_ERR,
+    PIO_STREAM_IN,
+    PIO_FRAME_INTERRUPT,        /* Daemon connection only: send SIGINT */
+    PIO_FRAME_SESSION           /* Daemon connection only, the first frame:
+                                 * name of a shared session, or empty */
+} pio_stream;
+
 typedef struct _pio_env pio_env;
+typedef struct _pio_backend pio_backend;
+typedef struct _pio_replay pio_replay;
+typedef struct _pio_remote pio_remote;
+
+/* Called for every chunk read from the child's stdout or stderr */
+typedef void (*pio_read_func) (pio_stream   stream,
+                               guint8      *data,
+                               gsize        bytes,
+                               gpointer     user_data);
+
+/* Called whenever the number of bytes waiting to be written to the child's
+ * stdin changes */
+typedef void (*pio_queue_func) (pio_env *env, gsize queued, gpointer user_data);
+
+/* Called once the child has exited, before the environment is freed */
+typedef void (*pio_exit_func) (pio_env *env, gpointer user_data);
+
+/* What a session is connected to: a local child, a recording, or a
+ * connection to a daemon hosting the child */
+struct _pio_backend
+{
+    void     (*write)     (pio_env *env, const gchar *data, gsize len);
+    gboolean (*interrupt) (pio_env *env);
+    void     (*kill)      (pio_env *env);
+};
 
 struct _pio_env
 {
     GtkWidget    *window;
 
+    const pio_backend *backend;
+
     GIOChannel   *io_out,
                  *io_err,
-                 *io_in,
-                 *active;       /* Currently active channel or NULL */
+                 *io_in;
+
+    pio_stream    active;       /* Currently active stream or
+                                 * PIO_STREAM_NONE */
 
     GSource      *src_out,      /* Event sources for stdout and stderr */
-                 *src_err;
+                 *src_err,
+                 *src_in;       /* Writability watch, while data is queued */
+
+    GQueue        write_queue;  /* GBytes waiting to be written to stdin */
+    gsize         write_offset, /* Bytes of the queue head already written */
+                  queued;       /* Total bytes waiting to be written */
 
     GByteArray   *read_out,     /* Read buffers for stdout and stderr */
                  *read_err,
                  *buffer;       /* Auxiliary buffer to use when the other
                                  * stream is active. */
+
+    pio_read_func read_func;
+    gpointer      read_data;
+
+    pio_queue_func queue_func;
+    gpointer      queue_data;
+
+    pio_exit_func exit_func;
+    gpointer      exit_data;
+
+    pio_recorder *recorder;     /* Session recording, or NULL */
+    pio_replay   *replay;       /* Replay source when there is no child */
+    pio_remote   *remote;       /* Frame reader for a socket connection */
+
+    gint          priority,     /* Of the event sources, G_PRIORITY_* */
+                  nice;         /* Scheduling priority of a local child */
+
     GPid          pid;
 };
 
-gboolean processio_init (char *argv[], pio_env **io_env, GSourceFunc callback, gpointer data);
+pio_env *processio_env_new      (GtkWidget *window);
+void     processio_env_free     (pio_env *env);
+gboolean processio_init        (char *argv[], pio_env **io_env,
+                                pio_read_func callback, gpointer data);
+gboolean processio_socket_init (gint fd, pio_env **io_env,
+                                pio_read_func callback, gpointer data);
+gboolean processio_connect     (const gchar *path, const gchar *share,
+                                pio_env **io_env, pio_read_func callback,
+                                gpointer data, GError **error);
+gboolean processio_replay_init (const gchar *path, gboolean fast,
+                                pio_env **io_env, pio_read_func callback,
+                                gpointer data, GError **error);
+gboolean processio_record      (pio_env *env, const gchar *path,
+                                GError **error);
+void     processio_write       (pio_env *env, const gchar *data,
+                                gssize len);
+void     processio_send        (pio_env *env, pio_stream type,
+                                const guint8 *data, gsize len);
+void     processio_submit      (pio_env *env, const gchar *text);
+gsize    processio_prompt_end  (const guint8 *tail, guint tlen,
+                                const guint8 *data, gsize bytes);
+gsize    processio_get_queued  (pio_env *env);
+void     processio_replace     (pio_env *old, pio_env *env);
+gboolean processio_interrupt   (pio_env *env);
+void     processio_kill        (pio_env *env);
 
 G_END_DECLS
 
@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <glib/gstdio.h>
+#include "record.h"
+
+#define RECORD_IO_BUF_SIZE 65536
+
+struct _pio_recorder
+{
+    FILE        *file;
+    gint64       start;         /* Monotonic time of the first record */
+    GByteArray  *data;          /* Payload buffer when reading */
+};
+
+typedef struct
+{
+    guint8   stream;
+    guint8   pad[3];
+    guint32  length;
+    gint64   timestamp;
+} record_header;
+
+static pio_recorder *
+recorder_new (const gchar  *path,
+              const gchar  *mode,
+              GError      **error)
+{
+    pio_recorder *rec;
+    FILE         *file;
+
+    file = g_fopen (path, mode);
+    if (!file) {
+        g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+                     "%s: %s", path, g_strerror (errno));
+        return NULL;
+    }
+    setvbuf (file, NULL, _IOFBF, RECORD_IO_BUF_SIZE);
+
+    rec        = g_malloc0 (sizeof (pio_recorder));
+    rec->file  = file;
+    rec->start = g_get_monotonic_time ();
+
+    return rec;
+}
+
+pio_recorder *
+recorder_open (const gchar  *path,
+               GError      **error)
+{
+    pio_recorder *rec = recorder_new (path, "wb", error);
+
+    if (rec) {
+        fwrite (RECORD_MAGIC, 1, RECORD_MAGIC_LEN, rec->file);
+    }
+    return rec;
+}
+
+void
+recorder_write (pio_recorder  *rec,
+                guint8         stream,
+                const guint8  *data,
+                gsize          length)
+{
+    record_header hdr;
+
+    memset (&hdr, 0, sizeof (hdr));
+    hdr.stream    = stream;
+    hdr.length    = GUINT32_TO_LE ((guint32) length);
+    hdr.timestamp = GINT64_TO_LE (g_get_monotonic_time () - rec->start);
+
+    fwrite (&hdr, sizeof (hdr), 1, rec->file);
+    fwrite (data, 1, length, rec->file);
+}
+
+void
+recorder_close (pio_recorder *rec)
+{
+    fclose (rec->file);
+    if (rec->data) {
+        g_byte_array_free (rec->data, TRUE);
+    }
+    g_free (rec);
+}
+
+pio_recorder *
+record_reader_open (const gchar  *path,
+                    GError      **error)
+{
+    pio_recorder *rec = recorder_new (path, "rb", error);
+    gchar         magic[RECORD_MAGIC_LEN];
+
+    if (!rec) {
+        return NULL;
+    }
+
+    if (1 != fread (magic, RECORD_MAGIC_LEN, 1, rec->file)
+            || memcmp (magic, RECORD_MAGIC, RECORD_MAGIC_LEN)) {
+        g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+                     "%s: not a session recording", path);
+        recorder_close (rec);
+        return NULL;
+    }
+
+    rec->data = g_byte_array_new ();
+    return rec;
+}
+
+/**
+ * Read the next record. Returns FALSE at end of file or on a truncated
+ * record.
+ */
+gboolean
+record_reader_next (pio_recorder *rec,
+                    pio_record   *record)
+{
+    record_header hdr;
+
+    if (1 != fread (&hdr, sizeof (hdr), 1, rec->file)) {
+        return FALSE;
+    }
+
+    record->stream    = hdr.stream;
+    record->length    = GUINT32_FROM_LE (hdr.length);
+    record->timestamp = GINT64_FROM_LE (hdr.timestamp);
+
+    g_byte_array_set_size (rec->data, record->length);
+    if (record->length
+            && 1 != fread (rec->data->data, record->length, 1, rec->file)) {
+        return FALSE;
+    }
+    record->data = rec->data->data;
+
+    return TRUE;
+}
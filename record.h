@@ -0,0 +1,43 @@
+#ifndef RECORD_H
+#define RECORD_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Session recording file format (all integers little-endian):
+ *
+ *   header  : "GGHCREC1"
+ *   record  : guint8  stream    (pio_stream)
+ *             guint8  pad[3]
+ *             guint32 length
+ *             gint64  timestamp (microseconds since recording started)
+ *             guint8  data[length]
+ */
+
+#define RECORD_MAGIC      "GGHCREC1"
+#define RECORD_MAGIC_LEN  8
+
+typedef struct _pio_recorder pio_recorder;
+typedef struct _pio_record   pio_record;
+
+struct _pio_record
+{
+    guint8   stream;
+    guint32  length;
+    gint64   timestamp;
+    guint8  *data;              /* Owned by the reader, valid until the
+                                 * next call to record_reader_next () */
+};
+
+pio_recorder *recorder_open        (const gchar *path, GError **error);
+void          recorder_write       (pio_recorder *rec, guint8 stream,
+                                    const guint8 *data, gsize length);
+void          recorder_close       (pio_recorder *rec);
+
+pio_recorder *record_reader_open   (const gchar *path, GError **error);
+gboolean      record_reader_next   (pio_recorder *rec, pio_record *record);
+
+G_END_DECLS
+
+#endif /* RECORD_H */
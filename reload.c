@@ -0,0 +1,710 @@
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <glib/gstdio.h>
+#include "reload.h"
+#include "trace.h"
+
+/* Printed by the shadow once its :load is done, and ahead of the module
+ * graph and the scope it reports */
+#define RELOAD_READY        "-- gtk-ghci: shadow ready --"
+#define RELOAD_MODULES      "-- gtk-ghci: modules --"
+#define RELOAD_SCOPE        "-- gtk-ghci: scope --"
+#define RELOAD_WATCH_MASK   (IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE \
+                             | IN_DELETE)
+
+typedef struct _shadow shadow;
+
+/* A ghci compiling the project in the background */
+struct _shadow
+{
+    reloader     *r;            /* NULL once abandoned */
+    pio_env      *env;
+    GString      *log,          /* Everything the shadow printed */
+                 *out;          /* Its stdout alone */
+    gchar        *scope;        /* What :show imports said, once ready */
+    gint64        started;
+    gboolean      probe,        /* Only there to learn the module graph */
+                  ready,        /* Done loading */
+                  ok;           /* ... without errors */
+};
+
+struct _reloader
+{
+    gchar       **argv;         /* ghci, building object code */
+    GPtrArray    *files;        /* Targets of the last :load, as paths */
+    GHashTable   *modules;      /* Paths of every module they pulled in */
+    GPtrArray    *context;      /* Commands since that shaped the scope */
+    gchar        *cwd;          /* Set by :cd, NULL for ours */
+    gchar        *opaque;       /* A command that cannot be replayed */
+    GHashTable   *dirs;         /* Watch descriptor -> watched directory */
+    GIOChannel   *channel;      /* inotify instance */
+    guint         watch,
+                  debounce;
+    shadow       *shadow;
+    reload_func   func;
+    gpointer      data;
+};
+
+static void
+shadow_free (shadow *sh)
+{
+    g_string_free (sh->log, TRUE);
+    g_string_free (sh->out, TRUE);
+    g_free (sh->scope);
+    g_free (sh);
+}
+
+static void
+append_capped (GString      *s,
+               const guint8 *data,
+               gsize         bytes)
+{
+    g_string_append_len (s, (const gchar *) data, bytes);
+    if (s->len > RELOAD_LOG_MAX) {
+        g_string_erase (s, 0, s->len - RELOAD_LOG_MAX / 2);
+    }
+}
+
+/**
+ * Let a shadow session run into the void; it is released once killed.
+ */
+static void
+shadow_abandon (reloader *r)
+{
+    shadow *sh = r->shadow;
+
+    if (sh) {
+        r->shadow = NULL;
+        sh->r     = NULL;
+        processio_kill (sh->env);
+    }
+}
+
+/**
+ * What the shadow printed between the line marker and the line before,
+ * with the prompts of its commands taken out.
+ */
+static gchar *
+shadow_answer (shadow       *sh,
+               const gchar  *marker,
+               const gchar  *before)
+{
+    const gchar *start = strstr (sh->out->str, marker),
+                *end;
+
+    if (!start) {
+        return g_strdup ("");
+    }
+    start += strlen (marker) + 1;
+    if (g_str_has_prefix (start, TAIL_STRING)) {
+        start += TAIL_SIZE;
+    }
+
+    end = strstr (start, before);
+    if (!end) {
+        end = start;
+    } else if (end - start >= TAIL_SIZE
+            && !strncmp (end - TAIL_SIZE, TAIL_STRING, TAIL_SIZE)) {
+        end -= TAIL_SIZE;
+    }
+    return g_strndup (start, end - start);
+}
+
+static void
+watch_dir (reloader     *r,
+           const gchar  *path)
+{
+    gchar *dir = g_path_get_dirname (path);
+    gint   wd;
+
+    wd = inotify_add_watch (g_io_channel_unix_get_fd (r->channel), dir,
+                            RELOAD_WATCH_MASK);
+    if (wd < 0) {
+        g_warning ("Cannot watch %s: %s", dir, g_strerror (errno));
+        g_free (dir);
+        return;
+    }
+    g_hash_table_replace (r->dirs, GINT_TO_POINTER (wd), dir);
+}
+
+/**
+ * Take in the module graph of a build from its :show modules, lines of
+ * the form "Name ( path, object )", and watch every module's directory.
+ */
+static void
+add_modules (reloader *r,
+             shadow   *sh)
+{
+    gchar  *answer = shadow_answer (sh, RELOAD_MODULES, RELOAD_SCOPE);
+    gchar **lines  = g_strsplit (answer, "\n", -1),
+           *path;
+    gchar  *open,
+           *comma;
+    guint   i;
+
+    for (i = 0; lines[i]; ++i) {
+        open  = strstr (lines[i], "( ");
+        comma = open ? strchr (open, ',') : NULL;
+        if (!comma) {
+            continue;
+        }
+        *comma = '\0';
+
+        path = g_canonicalize_filename (open + 2, r->cwd);
+        if (!g_hash_table_contains (r->modules, path)) {
+            watch_dir (r, path);
+            g_hash_table_add (r->modules, path);
+        } else {
+            g_free (path);
+        }
+    }
+
+    g_strfreev (lines);
+    g_free (answer);
+}
+
+static void
+on_shadow_read (pio_stream   stream,
+                guint8      *data,
+                gsize        bytes,
+                shadow      *sh)
+{
+    reloader *r = sh->r;
+    gdouble   ms;
+
+    if (!bytes || !r || sh->ready) {
+        return;
+    }
+
+    append_capped (sh->log, data, bytes);
+    if (PIO_STREAM_OUT != stream) {
+        return;
+    }
+
+    append_capped (sh->out, data, bytes);
+    if (!g_str_has_suffix (sh->out->str, RELOAD_READY "\n" TAIL_STRING)) {
+        return;
+    }
+
+    sh->ready = TRUE;
+    sh->ok    = !strstr (sh->out->str, "Failed,");
+    sh->scope = shadow_answer (sh, RELOAD_SCOPE, RELOAD_READY);
+    ms        = (g_get_monotonic_time () - sh->started) / 1000.0;
+
+    TRACE_INSTANT ("reload.ready", ms);
+
+    /* Modules that failed to build are still part of the graph */
+    add_modules (r, sh);
+
+    if (sh->probe) {
+        /* The sources are as the foreground loaded them */
+        shadow_abandon (r);
+        return;
+    }
+
+    if (!sh->ok) {
+        /* Nothing worth swapping in; report and let it go */
+        r->func (r, FALSE, sh->log->str, ms, r->data);
+        if (r->shadow == sh) {
+            shadow_abandon (r);
+        }
+        return;
+    }
+
+    /* The callback may take the session right away, freeing sh */
+    r->func (r, TRUE, sh->log->str, ms, r->data);
+}
+
+static void
+on_shadow_exit (pio_env G_GNUC_UNUSED *env,
+                shadow                *sh)
+{
+    if (sh->r) {
+        g_warning ("Background reload: ghci exited unexpectedly");
+        sh->r->shadow = NULL;
+    }
+    shadow_free (sh);
+}
+
+static void
+append_quoted (GString      *s,
+               const gchar  *path)
+{
+    g_string_append_c (s, '"');
+    for (; *path; ++path) {
+        if ('"' == *path || '\\' == *path) {
+            g_string_append_c (s, '\\');
+        }
+        g_string_append_c (s, *path);
+    }
+    g_string_append_c (s, '"');
+}
+
+/**
+ * Start compiling the tracked files in a fresh shadow session, replacing
+ * one that is still busy with an older version of them. The scope of the
+ * foreground is set up again after the :load: :cd comes first, as it
+ * unloads everything, and then the rest in the order it was given. The
+ * shadow then reports the module graph and the resulting scope. A probe
+ * only does so, to find out what to watch; it is never swapped in.
+ */
+static void
+shadow_start (reloader *r,
+              gboolean  probe)
+{
+    shadow      *sh;
+    GString     *cmd;
+    const gchar *line;
+    guint        i;
+
+    shadow_abandon (r);
+
+    if (!r->files->len || r->opaque) {
+        return;
+    }
+
+    sh          = g_malloc0 (sizeof (shadow));
+    sh->r       = r;
+    sh->probe   = probe;
+    sh->env     = processio_env_new (NULL);
+    sh->log     = g_string_new (NULL);
+    sh->out     = g_string_new (NULL);
+    sh->started = g_get_monotonic_time ();
+
+    if (!processio_init (r->argv, &sh->env, (pio_read_func) on_shadow_read,
+                         sh)) {
+        processio_env_free (sh->env);
+        shadow_free (sh);
+        return;
+    }
+    sh->env->exit_func = (pio_exit_func) on_shadow_exit;
+    sh->env->exit_data = sh;
+
+    cmd = g_string_new (":set prompt \"" TAIL_STRING "\"\n");
+    if (r->cwd) {
+        g_string_append (cmd, ":cd ");
+        append_quoted (cmd, r->cwd);
+        g_string_append_c (cmd, '\n');
+    }
+
+    g_string_append (cmd, ":load");
+    for (i = 0; i < r->files->len; ++i) {
+        g_string_append_c (cmd, ' ');
+        append_quoted (cmd, g_ptr_array_index (r->files, i));
+    }
+    g_string_append_c (cmd, '\n');
+
+    for (i = 0; i < r->context->len; ++i) {
+        line = g_ptr_array_index (r->context, i);
+        g_string_append_printf (cmd, "%s\n", line);
+    }
+
+    g_string_append (cmd,
+                     "System.IO.putStrLn \"" RELOAD_MODULES "\"\n"
+                     ":show modules\n"
+                     "System.IO.putStrLn \"" RELOAD_SCOPE "\"\n"
+                     ":show imports\n"
+                     "System.IO.putStrLn \"" RELOAD_READY "\"\n");
+
+    processio_write (sh->env, cmd->str, cmd->len);
+    g_string_free (cmd, TRUE);
+
+    r->shadow = sh;
+
+    if (!probe) {
+        g_message ("Reloading %u target%s in the background", r->files->len,
+                   1 == r->files->len ? "" : "s");
+    }
+}
+
+static gboolean
+on_debounce (reloader *r)
+{
+    r->debounce = 0;
+    shadow_start (r, FALSE);
+
+    return G_SOURCE_REMOVE;
+}
+
+/**
+ * Whether path is a :load target, or a module that one of them imports.
+ */
+static gboolean
+is_tracked (reloader     *r,
+            const gchar  *path)
+{
+    guint i;
+
+    if (g_hash_table_contains (r->modules, path)) {
+        return TRUE;
+    }
+    for (i = 0; i < r->files->len; ++i) {
+        if (!strcmp (g_ptr_array_index (r->files, i), path)) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+static gboolean
+is_source (const gchar *name)
+{
+    return g_str_has_suffix (name, ".hs")
+        || g_str_has_suffix (name, ".lhs")
+        || g_str_has_suffix (name, ".hs-boot");
+}
+
+static gboolean
+on_inotify (GIOChannel   *channel,
+            GIOCondition  G_GNUC_UNUSED cond,
+            reloader     *r)
+{
+    guint64                     buf[512];   /* Aligned for the events */
+    const struct inotify_event *ev;
+    gssize                      n;
+    const gchar                *p,
+                               *dir;
+    gchar                      *path;
+    gboolean                    changed = FALSE;
+
+    while ((n = read (g_io_channel_unix_get_fd (channel), buf,
+                      sizeof (buf))) > 0) {
+        for (p = (const gchar *) buf; p < (const gchar *) buf + n;
+             p += sizeof (*ev) + ev->len) {
+            ev = (const struct inotify_event *) p;
+
+            if (ev->mask & IN_IGNORED) {
+                g_hash_table_remove (r->dirs, GINT_TO_POINTER (ev->wd));
+                continue;
+            }
+
+            dir = g_hash_table_lookup (r->dirs, GINT_TO_POINTER (ev->wd));
+            if (!ev->len || !dir || !is_source (ev->name)) {
+                continue;
+            }
+
+            /* Other sources in the same directories are none of ours */
+            path     = g_build_filename (dir, ev->name, NULL);
+            changed |= is_tracked (r, path);
+            g_free (path);
+        }
+    }
+
+    if (changed) {
+        /* Editors write in several steps; wait for the last one */
+        if (r->debounce) {
+            g_source_remove (r->debounce);
+        }
+        r->debounce = g_timeout_add (RELOAD_DEBOUNCE_MS,
+                                     (GSourceFunc) on_debounce, r);
+    }
+
+    return TRUE;
+}
+
+/**
+ * Resolve a :load target, a file or a module name, to a path, and watch
+ * the directory it lives in.
+ */
+static void
+add_target (reloader     *r,
+            const gchar  *target)
+{
+    gchar *base,
+          *path;
+
+    if ('*' == *target) {
+        ++target;
+    }
+
+    /* Relative to where ghci is, which :cd may have changed */
+    if (is_source (target)) {
+        path = g_canonicalize_filename (target, r->cwd);
+    } else {
+        base = g_strdelimit (g_strdup (target), ".", G_DIR_SEPARATOR);
+        path = g_strconcat (base, ".hs", NULL);
+        g_free (base);
+
+        base = path;
+        path = g_canonicalize_filename (base, r->cwd);
+        g_free (base);
+
+        if (!g_file_test (path, G_FILE_TEST_EXISTS)) {
+            path[strlen (path) - 2] = '\0';
+            base = path;
+            path = g_strconcat (base, "lhs", NULL);
+            g_free (base);
+        }
+    }
+
+    if (!g_file_test (path, G_FILE_TEST_EXISTS)) {
+        /* A module from a package, or a typo that ghci reports */
+        g_free (path);
+        return;
+    }
+
+    g_ptr_array_add (r->files, path);
+    watch_dir (r, path);
+}
+
+static gboolean
+is_command (const gchar *word,
+            const gchar *command)
+{
+    gsize len = strlen (word);
+
+    /* ghci accepts any prefix, :l for :load and :a for :add */
+    return len >= 2 && len <= strlen (command)
+        && !strncmp (word, command, len);
+}
+
+/**
+ * Look at a command sent to the foreground session and keep track of the
+ * files it has loaded, and of the commands that set up its scope, for the
+ * shadow to repeat. After :script or :def the session holds more than can
+ * be repeated, and background reloads stop.
+ */
+void
+reloader_track (reloader     *r,
+                const gchar  *command)
+{
+    gchar  *dir;
+    gchar **args;
+    gint    argc,
+            i;
+
+    while (g_ascii_isspace (*command)) {
+        ++command;
+    }
+    if (strchr (command, '\n')) {
+        /* Definitions over several lines are bindings, not scope */
+        return;
+    }
+
+    if (g_str_has_prefix (command, "import ")) {
+        g_ptr_array_add (r->context, g_strdup (command));
+        return;
+    }
+    if (':' != *command) {
+        return;
+    }
+
+    if (!g_shell_parse_argv (command, &argc, &args, NULL)) {
+        return;
+    }
+
+    if (is_command (args[0], ":cd")) {
+        if (argc > 1) {
+            dir = g_canonicalize_filename (args[1], r->cwd);
+            g_free (r->cwd);
+            r->cwd = dir;
+        }
+        g_strfreev (args);
+        return;
+    }
+
+    if ((is_command (args[0], ":set")
+            && !(argc > 1 && g_str_has_prefix (args[1], "prompt")))
+            || !strcmp (args[0], ":seti") || is_command (args[0], ":unset")
+            || is_command (args[0], ":module")) {
+        g_ptr_array_add (r->context, g_strdup (command));
+        g_strfreev (args);
+        return;
+    }
+
+    if (!r->opaque && (is_command (args[0], ":script")
+            || is_command (args[0], ":def")
+            || is_command (args[0], ":undef"))) {
+        r->opaque = g_strdup (args[0]);
+        shadow_abandon (r);
+        g_message ("Background reload off: %s cannot be repeated",
+                   r->opaque);
+    }
+
+    if (is_command (args[0], ":load")) {
+        g_ptr_array_set_size (r->files, 0);
+        g_hash_table_remove_all (r->modules);
+    } else if (!is_command (args[0], ":add")) {
+        g_strfreev (args);
+        return;
+    }
+
+    for (i = 1; i < argc; ++i) {
+        add_target (r, args[i]);
+    }
+    g_strfreev (args);
+
+    /* Build once to learn the module graph, and warm the objects */
+    shadow_start (r, TRUE);
+}
+
+/**
+ * The answer to :show imports, with the modules added by :load reduced to
+ * their names: they are "*"-imported while interpreted, and not once
+ * built to object code, as the shadow builds them.
+ */
+static gchar *
+scope_normalize (const gchar *scope)
+{
+    GString      *norm  = g_string_new (NULL);
+    gchar       **lines = g_strsplit (scope, "\n", -1),
+                 *mark,
+                 *name;
+    guint         i;
+
+    for (i = 0; lines[i]; ++i) {
+        mark = strstr (lines[i], " -- added automatically");
+        if (mark) {
+            *mark = '\0';
+            name  = strrchr (lines[i], ' ');
+            name  = name ? name + 1 : lines[i];
+            name += '+' == *name;
+            name += '*' == *name;
+            g_string_append_printf (norm, "%s (loaded)\n", name);
+        } else if (*lines[i]) {
+            g_string_append_printf (norm, "%s\n", lines[i]);
+        }
+    }
+
+    g_strfreev (lines);
+    return g_string_free (norm, FALSE);
+}
+
+/**
+ * Hand over a shadow session that has loaded the current sources, or
+ * return NULL if there is none. scope is what :show imports says in the
+ * foreground; a shadow that ended up with a different one is dropped, and
+ * error set. The caller takes over the session, and must install its own
+ * callbacks (see processio_replace ()) before returning to the main loop.
+ */
+pio_env *
+reloader_take (reloader     *r,
+               const gchar  *scope,
+               GError      **error)
+{
+    shadow   *sh = r->shadow;
+    pio_env  *env;
+    gchar    *theirs,
+             *ours;
+    gboolean  same;
+
+    if (!sh || !sh->ok) {
+        return NULL;
+    }
+
+    theirs = scope_normalize (sh->scope);
+    ours   = scope_normalize (scope);
+    same   = !strcmp (theirs, ours);
+    if (!same) {
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                     "The reloaded session's scope differs:\n%s"
+                     "instead of\n%s", theirs, ours);
+        shadow_abandon (r);
+    }
+    g_free (theirs);
+    g_free (ours);
+    if (!same) {
+        return NULL;
+    }
+
+    env            = sh->env;
+    env->exit_func = NULL;
+    r->shadow      = NULL;
+    shadow_free (sh);
+
+    return env;
+}
+
+/**
+ * Watch the sources loaded into the foreground session, and rebuild them
+ * in a shadow ghci when they change. argv launches ghci; the shadow adds
+ * -fobject-code, sharing one object directory between builds so that each
+ * only recompiles what changed. The directory is keyed by the project (the
+ * working directory), so projects never see each other's objects. Returns
+ * NULL if inotify is unavailable.
+ */
+reloader *
+reloader_new (gchar        **argv,
+              reload_func    func,
+              gpointer       data)
+{
+    reloader *r;
+    gchar    *cwd,
+             *dir,
+             *hash,
+             *cache;
+    guint     n = g_strv_length (argv),
+              i;
+    gint      fd;
+
+    fd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0) {
+        g_warning ("inotify: %s", g_strerror (errno));
+        return NULL;
+    }
+
+    /* One directory per project: modules named alike in two projects
+     * must not share object files */
+    cwd   = g_get_current_dir ();
+    dir   = g_canonicalize_filename (cwd, NULL);
+    hash  = g_compute_checksum_for_string (G_CHECKSUM_SHA1, dir, -1);
+    hash[16] = '\0';
+    cache = g_build_filename (g_get_user_cache_dir (), "gtk-ghci", "objects",
+                              hash, NULL);
+    g_free (hash);
+    g_free (dir);
+    g_free (cwd);
+    if (g_mkdir_with_parents (cache, 0700)) {
+        g_warning ("%s: %s", cache, g_strerror (errno));
+    }
+
+    r       = g_malloc0 (sizeof (reloader));
+    r->argv = g_malloc_n (n + 6, sizeof (gchar *));
+    for (i = 0; i < n; ++i) {
+        r->argv[i] = g_strdup (argv[i]);
+    }
+    r->argv[n]     = g_strdup ("-fobject-code");
+    r->argv[n + 1] = g_strdup ("-odir");
+    r->argv[n + 2] = g_strdup (cache);
+    r->argv[n + 3] = g_strdup ("-hidir");
+    r->argv[n + 4] = cache;
+    r->argv[n + 5] = NULL;
+
+    r->files   = g_ptr_array_new_with_free_func (g_free);
+    r->modules = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                        g_free, NULL);
+    r->context = g_ptr_array_new_with_free_func (g_free);
+    r->dirs    = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                                        NULL, g_free);
+    r->channel = g_io_channel_unix_new (fd);
+    r->func    = func;
+    r->data    = data;
+
+    g_io_channel_set_close_on_unref (r->channel, TRUE);
+    r->watch = g_io_add_watch (r->channel, G_IO_IN,
+                               (GIOFunc) on_inotify, r);
+
+    return r;
+}
+
+void
+reloader_free (reloader *r)
+{
+    if (r->debounce) {
+        g_source_remove (r->debounce);
+    }
+    g_source_remove (r->watch);
+    shadow_abandon (r);
+
+    g_io_channel_unref (r->channel);
+    g_hash_table_destroy (r->dirs);
+    g_ptr_array_free (r->files, TRUE);
+    g_hash_table_destroy (r->modules);
+    g_ptr_array_free (r->context, TRUE);
+    g_free (r->cwd);
+    g_free (r->opaque);
+    g_strfreev (r->argv);
+    g_free (r);
+}
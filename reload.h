@@ -0,0 +1,25 @@
+#ifndef RELOAD_H
+#define RELOAD_H
+
+#include "processio.h"
+
+G_BEGIN_DECLS
+
+#define RELOAD_DEBOUNCE_MS  150
+#define RELOAD_LOG_MAX      (1024 * 1024)
+
+typedef struct _reloader reloader;
+
+/* Called when a shadow session has finished loading. On success the session
+ * is waiting to be picked up with reloader_take (). */
+typedef void (*reload_func) (reloader *r, gboolean ok, const gchar *log,
+                             gdouble ms, gpointer user_data);
+
+reloader *reloader_new   (gchar **argv, reload_func func, gpointer data);
+void      reloader_track (reloader *r, const gchar *command);
+pio_env  *reloader_take  (reloader *r, const gchar *scope, GError **error);
+void      reloader_free  (reloader *r);
+
+G_END_DECLS
+
+#endif /* RELOAD_H */
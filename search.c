@@ -0,0 +1,258 @@
+#include <string.h>
+#include "search.h"
+#include "trace.h"
+
+#define SEARCH_SLICE          (4 * 1024 * 1024)  /* Bytes scanned per idle */
+#define SEARCH_HIGHLIGHT_MAX  10000              /* Matches given a tag */
+
+struct _search
+{
+    outview     *out;
+    GtkWidget   *entry,
+                *label;
+    GtkTextTag  *tag_match,
+                *tag_current;
+    gchar       *needle;
+    gsize        nlen;
+    guint64      scan_pos,      /* Matches starting before this are counted */
+                 current;       /* Offset of the selected match */
+    gboolean     has_current,
+                 reveal;        /* The current match waits for its fold */
+    guint        count,
+                 idle;
+};
+
+/**
+ * Buffer range of the match at offset. Returns FALSE if the match is hidden
+ * in a fold; with expand set the fold is opened instead.
+ */
+static gboolean
+match_bounds (search       *s,
+              guint64       offset,
+              gboolean      expand,
+              GtkTextIter  *start,
+              GtkTextIter  *end)
+{
+    if (!outview_offset_to_iter (s->out, offset, expand, start)) {
+        return FALSE;
+    }
+    *end = *start;
+    gtk_text_iter_forward_chars (end, g_utf8_strlen (s->needle, s->nlen));
+    return TRUE;
+}
+
+static void
+show_match (search  *s,
+            guint64  offset)
+{
+    GtkTextIter start,
+                end;
+
+    if (s->has_current && match_bounds (s, s->current, FALSE, &start, &end)) {
+        gtk_text_buffer_remove_tag (s->out->buffer, s->tag_current,
+                                    &start, &end);
+    }
+
+    s->current     = offset;
+    s->has_current = TRUE;
+
+    /* A folded match is at its marker until the fold has opened */
+    s->reveal = !match_bounds (s, offset, TRUE, &start, &end);
+    if (!s->reveal) {
+        gtk_text_buffer_apply_tag (s->out->buffer, s->tag_current,
+                                   &start, &end);
+    }
+    gtk_text_view_scroll_to_iter (s->out->view, &start, 0.1, FALSE, 0, 0);
+}
+
+static void
+on_expanded (outview G_GNUC_UNUSED *out,
+             search                *s)
+{
+    if (s->has_current && s->reveal) {
+        show_match (s, s->current);
+    }
+}
+
+static void
+update_label (search *s)
+{
+    gchar *text;
+
+    if (!s->needle) {
+        gtk_label_set_text (GTK_LABEL (s->label), "");
+        return;
+    }
+
+    text = g_strdup_printf ("%u match%s%s", s->count,
+                            1 == s->count ? "" : "es",
+                            s->idle ? "…" : "");
+    gtk_label_set_text (GTK_LABEL (s->label), text);
+    g_free (text);
+}
+
+/**
+ * Count, and highlight, the matches in the next slice of the transcript.
+ * The first match found is selected.
+ */
+static gboolean
+scan_slice (search *s)
+{
+    transcript  *t = s->out->transcript;
+    guint64      end,
+                 hit;
+    GtkTextIter  start_iter,
+                 end_iter;
+
+    TRACE_BEGIN ("search.scan_slice");
+
+    if (t->length < s->nlen
+            || s->scan_pos >= t->length - s->nlen + 1) {
+        s->idle = 0;
+        update_label (s);
+        TRACE_END ("search.scan_slice");
+        return G_SOURCE_REMOVE;
+    }
+
+    /* Matches must start before end, but may extend past it */
+    end = MIN (s->scan_pos + SEARCH_SLICE, t->length - s->nlen + 1);
+
+    while (transcript_find (t, s->needle, s->nlen, s->scan_pos,
+                            end + s->nlen - 1, &hit)) {
+        if (++s->count <= SEARCH_HIGHLIGHT_MAX
+                && match_bounds (s, hit, FALSE, &start_iter, &end_iter)) {
+            gtk_text_buffer_apply_tag (s->out->buffer, s->tag_match,
+                                       &start_iter, &end_iter);
+        }
+        if (!s->has_current) {
+            show_match (s, hit);
+        }
+        s->scan_pos = hit + s->nlen;
+    }
+    s->scan_pos = MAX (s->scan_pos, end);
+
+    update_label (s);
+
+    TRACE_END ("search.scan_slice");
+    return G_SOURCE_CONTINUE;
+}
+
+static void
+search_reset (search *s)
+{
+    GtkTextIter start,
+                end;
+
+    if (s->idle) {
+        g_source_remove (s->idle);
+        s->idle = 0;
+    }
+
+    gtk_text_buffer_get_bounds (s->out->buffer, &start, &end);
+    gtk_text_buffer_remove_tag (s->out->buffer, s->tag_match, &start, &end);
+    gtk_text_buffer_remove_tag (s->out->buffer, s->tag_current, &start, &end);
+
+    g_free (s->needle);
+    s->needle      = NULL;
+    s->nlen        = 0;
+    s->count       = 0;
+    s->scan_pos    = 0;
+    s->has_current = FALSE;
+    s->reveal      = FALSE;
+}
+
+static void
+on_search_changed (GtkSearchEntry *entry,
+                   search         *s)
+{
+    const gchar *text = gtk_entry_get_text (GTK_ENTRY (entry));
+
+    search_reset (s);
+
+    if (*text) {
+        s->needle = g_strdup (text);
+        s->nlen   = strlen (text);
+        search_update (s);
+    }
+    update_label (s);
+}
+
+static void
+on_next_match (GtkEntry G_GNUC_UNUSED *entry,
+               search                 *s)
+{
+    guint64 hit;
+
+    if (!s->needle) {
+        return;
+    }
+
+    if (transcript_find (s->out->transcript, s->needle, s->nlen,
+                         s->has_current ? s->current + 1 : 0,
+                         G_MAXUINT64, &hit)
+     || transcript_find (s->out->transcript, s->needle, s->nlen,
+                         0, G_MAXUINT64, &hit)) {
+        show_match (s, hit);
+    }
+}
+
+static void
+on_stop_search (GtkSearchEntry G_GNUC_UNUSED *entry,
+                search                       *s)
+{
+    search_reset (s);
+    update_label (s);
+}
+
+search *
+search_new (outview   *out,
+            GtkWidget *entry,
+            GtkWidget *label)
+{
+    search *s = g_malloc0 (sizeof (search));
+
+    s->out   = out;
+    s->entry = entry;
+    s->label = label;
+
+    s->tag_match   = gtk_text_buffer_create_tag (out->buffer, NULL,
+                                                 "background", "#fce94f",
+                                                 NULL);
+    s->tag_current = gtk_text_buffer_create_tag (out->buffer, NULL,
+                                                 "background", "#f57900",
+                                                 NULL);
+
+    g_signal_connect (G_OBJECT (entry), "search-changed",
+                      G_CALLBACK (on_search_changed), s);
+    g_signal_connect (G_OBJECT (entry), "activate",
+                      G_CALLBACK (on_next_match), s);
+    g_signal_connect (G_OBJECT (entry), "stop-search",
+                      G_CALLBACK (on_stop_search), s);
+    outview_set_expand_func (out, (outview_expand_func) on_expanded, s);
+
+    return s;
+}
+
+/**
+ * Resume counting after new output has been appended to the transcript.
+ */
+void
+search_update (search *s)
+{
+    if (s->needle && !s->idle
+            && s->scan_pos + s->nlen <= s->out->transcript->length) {
+        s->idle = g_idle_add_full (G_PRIORITY_DEFAULT_IDLE,
+                                   (GSourceFunc) scan_slice, s, NULL);
+    }
+}
+
+void
+search_free (search *s)
+{
+    outview_set_expand_func (s->out, NULL, NULL);
+    if (s->idle) {
+        g_source_remove (s->idle);
+    }
+    g_free (s->needle);
+    g_free (s);
+}
@@ -0,0 +1,17 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include <gtk/gtk.h>
+#include "outview.h"
+
+G_BEGIN_DECLS
+
+typedef struct _search search;
+
+search *search_new    (outview *out, GtkWidget *entry, GtkWidget *label);
+void    search_update (search *s);
+void    search_free   (search *s);
+
+G_END_DECLS
+
+#endif /* SEARCH_H */
@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <errno.h>
+#include <glib/gstdio.h>
+#include "startup.h"
+#include "trace.h"
+
+typedef struct
+{
+    const gchar *name;
+    gint64       start,         /* Microseconds since startup_init () */
+                 end;
+} startup_record;
+
+static gint64    _t0       = 0;
+static GArray   *_records  = NULL;
+static gboolean  _reported = FALSE;
+
+/**
+ * Called first thing in main (); everything is timed from here.
+ */
+void
+startup_init (void)
+{
+    _t0      = g_get_monotonic_time ();
+    _records = g_array_new (FALSE, FALSE, sizeof (startup_record));
+}
+
+gint64
+startup_now (void)
+{
+    return g_get_monotonic_time ();
+}
+
+static void
+add (const gchar *name,
+     gint64       start)
+{
+    startup_record rec;
+
+    rec.name  = name;
+    rec.start = start - _t0;
+    rec.end   = g_get_monotonic_time () - _t0;
+
+    TRACE_INSTANT (name, rec.end - rec.start);
+
+    if (_reported) {
+        /* Finished after the summary went out */
+        g_message ("Startup: %s took %.1f ms, done at %.1f ms", name,
+                   (rec.end - rec.start) / 1000.0, rec.end / 1000.0);
+    } else {
+        g_array_append_val (_records, rec);
+    }
+}
+
+/**
+ * A phase that ran from start (a startup_now () time) until now.
+ */
+void
+startup_phase (const gchar *name,
+               gint64       start)
+{
+    add (name, start);
+}
+
+/**
+ * Something the user waits for, such as the first prompt, reached now.
+ */
+void
+startup_milestone (const gchar *name)
+{
+    add (name, _t0);
+}
+
+gboolean
+startup_reached (const gchar *name)
+{
+    guint i;
+
+    for (i = 0; i < _records->len; ++i) {
+        if (g_str_equal (g_array_index (_records, startup_record, i).name,
+                         name)) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/**
+ * Log what startup has done so far, and if path is given, append it to path
+ * as one JSON record so that runs can be compared over time. Anything that
+ * finishes later is logged on its own.
+ */
+void
+startup_report (const gchar *path)
+{
+    GString *summary;
+    FILE    *out = NULL;
+    guint    i;
+
+    if (_reported) {
+        return;
+    }
+    _reported = TRUE;
+
+    if (path) {
+        out = g_fopen (path, "a");
+        if (!out) {
+            g_warning ("%s: %s", path, g_strerror (errno));
+        } else {
+            fprintf (out, "{\"time\":%" G_GINT64_FORMAT,
+                     g_get_real_time () / G_USEC_PER_SEC);
+        }
+    }
+
+    summary = g_string_new ("Startup:");
+    for (i = 0; i < _records->len; ++i) {
+        startup_record *rec = &g_array_index (_records, startup_record, i);
+
+        if (rec->start) {
+            g_string_append_printf (summary, " %s %.1f ms (%.1f-%.1f),",
+                                    rec->name,
+                                    (rec->end - rec->start) / 1000.0,
+                                    rec->start / 1000.0, rec->end / 1000.0);
+        } else {
+            g_string_append_printf (summary, " %s at %.1f ms,", rec->name,
+                                    rec->end / 1000.0);
+        }
+
+        if (out) {
+            fprintf (out, ",\"%s\":{\"start_ms\":%.3f,\"end_ms\":%.3f}",
+                     rec->name, rec->start / 1000.0, rec->end / 1000.0);
+        }
+    }
+    g_string_truncate (summary, summary->len - (i ? 1 : 0));
+    g_message ("%s", summary->str);
+    g_string_free (summary, TRUE);
+
+    if (out) {
+        fputs ("}\n", out);
+        fclose (out);
+    }
+}
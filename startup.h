@@ -0,0 +1,20 @@
+#ifndef STARTUP_H
+#define STARTUP_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Startup timing. Phases have a start and an end, milestones only an end;
+ * both are measured from startup_init (). Names must be string literals. */
+
+void     startup_init      (void);
+gint64   startup_now       (void);
+void     startup_phase     (const gchar *name, gint64 start);
+void     startup_milestone (const gchar *name);
+gboolean startup_reached   (const gchar *name);
+void     startup_report    (const gchar *path);
+
+G_END_DECLS
+
+#endif /* STARTUP_H */
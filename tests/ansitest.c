@@ -0,0 +1,119 @@
+#include <string.h>
+#include "tests.h"
+#include "ansi.h"
+
+typedef struct
+{
+    GString  *out;
+    guint32   style;
+} runs;
+
+/* Runs as "{style}text", with adjacent runs of one style merged, so that
+ * the result does not depend on where the input was cut */
+static void
+collect (const gchar *text,
+         gsize        len,
+         guint32      style,
+         runs        *r)
+{
+    if (!r->out->len || style != r->style) {
+        g_string_append_printf (r->out, "{%x}", style);
+        r->style = style;
+    }
+    g_string_append_len (r->out, text, len);
+}
+
+static gchar *
+parse (const gchar *input,
+       gsize        piece)
+{
+    ansi_parser  parser;
+    runs         r   = { g_string_new (NULL), 0 };
+    gsize        len = strlen (input),
+                 i;
+
+    ansi_parser_init (&parser);
+    for (i = 0; i < len; i += piece) {
+        ansi_parser_feed (&parser, input + i, MIN (piece, len - i),
+                          (ansi_text_func) collect, &r);
+    }
+    return g_string_free (r.out, FALSE);
+}
+
+static void
+check (const gchar *input,
+       const gchar *expected)
+{
+    gsize  piece;
+    gchar *got;
+
+    /* Whole, then cut at every possible place */
+    for (piece = strlen (input); piece; --piece) {
+        got = parse (input, piece);
+        g_assert_cmpstr (got, ==, expected);
+        g_free (got);
+    }
+}
+
+static void
+test_plain (void)
+{
+    check ("Prelude> 1 + 1\n2\n", "{0}Prelude> 1 + 1\n2\n");
+}
+
+static void
+test_colors (void)
+{
+    gchar *expected;
+
+    expected = g_strdup_printf ("{0}a{%x}b{%x}c{0}d",
+                                1 + 1, (1 + 1) | ((4 + 1) << 9));
+    check ("a\033[31mb\033[44mc\033[0md", expected);
+    g_free (expected);
+
+    /* Bright colors, and an empty SGR as a reset */
+    expected = g_strdup_printf ("{%x}x{0}y", (9 + 1) | ANSI_STYLE_BOLD);
+    check ("\033[1;91mx\033[my", expected);
+    g_free (expected);
+}
+
+static void
+test_extended (void)
+{
+    gchar *expected;
+
+    expected = g_strdup_printf ("{%x}a{%x}b", 208 + 1,
+                                (208 + 1) | (16 + 1) << 9);
+    check ("\033[38;5;208ma\033[48;2;0;0;0mb", expected);
+    g_free (expected);
+}
+
+static void
+test_attributes (void)
+{
+    gchar *expected;
+
+    expected = g_strdup_printf ("{%x}a{%x}b",
+                                ANSI_STYLE_ITALIC | ANSI_STYLE_UNDERLINE,
+                                ANSI_STYLE_UNDERLINE);
+    check ("\033[3;4ma\033[23mb", expected);
+    g_free (expected);
+}
+
+static void
+test_stripped (void)
+{
+    /* Cursor movement, window titles and private modes leave no trace */
+    check ("a\033[2Kb\033]0;title\007c\033]2;t\033\\d\033[?25le\033(Bf",
+           "{0}abcdef");
+}
+
+void
+test_ansi_add (void)
+{
+    g_test_add_func ("/ansi/plain", test_plain);
+    g_test_add_func ("/ansi/colors", test_colors);
+    g_test_add_func ("/ansi/extended", test_extended);
+    g_test_add_func ("/ansi/attributes", test_attributes);
+    g_test_add_func ("/ansi/stripped", test_stripped);
+}
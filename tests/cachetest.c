@@ -0,0 +1,178 @@
+#include <string.h>
+#include "tests.h"
+#include "cache.h"
+
+/* The bootstrap queries that follow every command, as ghci answers them */
+static void
+complete (result_cache *c,
+          const gchar  *bindings,
+          const gchar  *type)
+{
+    result_cache_session (c, (const guint8 *) bindings, strlen (bindings));
+    if (result_cache_type_query (c)) {
+        result_cache_type (c, (const guint8 *) type, strlen (type));
+    }
+    result_cache_complete (c);
+}
+
+/* Evaluate input as ghci would, with the given answers to the queries */
+static void
+evaluate (result_cache *c,
+          const gchar  *input,
+          const gchar  *output,
+          const gchar  *bindings,
+          const gchar  *type)
+{
+    gchar  *rebind = NULL;
+    GBytes *hit    = result_cache_submit (c, input, TRUE, &rebind);
+
+    g_assert_null (hit);
+    g_assert_null (rebind);
+    result_cache_output (c, PIO_STREAM_OUT, (const guint8 *) output,
+                         strlen (output));
+    complete (c, bindings, type);
+}
+
+/* The cached output of input, and the command that rebinds it */
+static gchar *
+lookup (result_cache  *c,
+        const gchar   *input,
+        gchar        **rebind)
+{
+    GBytes        *hit;
+    const gchar   *data;
+    gchar         *output;
+    gsize          size;
+
+    *rebind = NULL;
+    hit     = result_cache_submit (c, input, TRUE, rebind);
+    if (!hit) {
+        g_assert_null (*rebind);
+        return NULL;
+    }
+    data   = g_bytes_get_data (hit, &size);
+    output = g_strndup (data, size);
+    g_bytes_unref (hit);
+
+    return output;
+}
+
+static result_cache *
+cache_new (void)
+{
+    result_cache *c = result_cache_new (1024 * 1024);
+
+    /* Nothing is cached before the first fingerprint */
+    complete (c, "", "");
+    return c;
+}
+
+static void
+test_hit (void)
+{
+    result_cache *c = cache_new ();
+    gchar        *output,
+                 *rebind;
+
+    g_assert_null (lookup (c, "sum [1..10]", &rebind));
+    evaluate (c, "sum [1..10]", "55\n", "it :: Integer = 55\n",
+              "sum [1..10] :: (Num a, Enum a) => a\n");
+
+    /* Spacing does not matter; it is rebound at its defaulted type */
+    output = lookup (c, "  sum  [1..10] ", &rebind);
+    g_assert_cmpstr (output, ==, "55\n");
+    g_assert_cmpstr (rebind, ==, "let it = (sum [1..10]) :: Integer");
+    g_free (output);
+    g_free (rebind);
+
+    /* A type broken over lines by :show bindings */
+    evaluate (c, "zip \"ab\" [1, 2]", "[('a',1),('b',2)]\n",
+              "it\n  :: [(Char,\n       Integer)]\n  = [('a',1),('b',2)]\n",
+              "zip \"ab\" [1, 2] :: Num b => [(Char, b)]\n");
+    output = lookup (c, "zip \"ab\" [1, 2]", &rebind);
+    g_assert_cmpstr (rebind, ==,
+                     "let it = (zip \"ab\" [1, 2]) :: [(Char, Integer)]");
+    g_free (output);
+    g_free (rebind);
+
+    result_cache_free (c);
+}
+
+static void
+test_impure (void)
+{
+    result_cache *c = cache_new ();
+    gchar        *rebind;
+
+    evaluate (c, "getLine", "x\n", "it :: String = \"x\"\n",
+              "getLine :: IO String\n");
+    g_assert_null (lookup (c, "getLine", &rebind));
+
+    /* Errors are not results */
+    g_assert_null (result_cache_submit (c, "head []", TRUE, &rebind));
+    result_cache_output (c, PIO_STREAM_ERR, (const guint8 *) "*** ", 4);
+    complete (c, "", "head [] :: a\n");
+    g_assert_null (lookup (c, "head []", &rebind));
+
+    result_cache_free (c);
+}
+
+static void
+test_unwritable (void)
+{
+    result_cache *c = cache_new ();
+    gchar        *rebind;
+
+    /* Rebinding at a constrained type would generalise it */
+    evaluate (c, "show", "", "it :: Show a => a -> String = _\n",
+              "show :: Show a => a -> String\n");
+    g_assert_null (lookup (c, "show", &rebind));
+
+    /* A type not in scope is shown qualified, and cannot be written */
+    evaluate (c, "Map.empty", "fromList []\n",
+              "it :: Data.Map.Internal.Map k a = fromList []\n",
+              "Map.empty :: Map.Map k a\n");
+    g_assert_null (lookup (c, "Map.empty", &rebind));
+
+    /* Nor can one that was never bound */
+    evaluate (c, "1 + 1", "2\n", "", "1 + 1 :: Num a => a\n");
+    g_assert_null (lookup (c, "1 + 1", &rebind));
+
+    result_cache_free (c);
+}
+
+static void
+test_generation (void)
+{
+    result_cache *c = cache_new ();
+    gchar        *output,
+                 *rebind;
+
+    complete (c, "x :: Integer = 1\n", "");
+    evaluate (c, "x * 2", "2\n", "x :: Integer = 1\nit :: Integer = 2\n",
+              "x * 2 :: Integer\n");
+    output = lookup (c, "x * 2", &rebind);
+    g_assert_cmpstr (output, ==, "2\n");
+    g_free (output);
+    g_free (rebind);
+    complete (c, "x :: Integer = 1\nit :: Integer = 2\n", "");
+
+    /* A new binding may shadow one the expression used */
+    g_assert_null (result_cache_submit (c, "x = 5", TRUE, &rebind));
+    complete (c, "x :: Integer = 1\nit :: Integer = 2\n", "");
+    g_assert_null (lookup (c, "x * 2", &rebind));
+
+    /* As may anything that mentions it */
+    g_assert_null (lookup (c, "it * 2", &rebind));
+
+    result_cache_free (c);
+}
+
+void
+test_cache_add (void)
+{
+    g_test_add_func ("/cache/hit", test_hit);
+    g_test_add_func ("/cache/impure", test_impure);
+    g_test_add_func ("/cache/unwritable", test_unwritable);
+    g_test_add_func ("/cache/generation", test_generation);
+}
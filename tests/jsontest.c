@@ -0,0 +1,72 @@
+#include <stdio.h>
+#include <string.h>
+#include "tests.h"
+#include "json.h"
+
+/* The escaped form of data, written in pieces of at most piece bytes */
+static gchar *
+escape (const gchar *data,
+        gsize        len,
+        gsize        piece)
+{
+    GError *error = NULL;
+    gchar  *path  = test_tmp_path ("escape.json"),
+           *contents;
+    FILE   *out   = fopen (path, "wb");
+    gsize   i;
+
+    g_assert_nonnull (out);
+    for (i = 0; i < len; i += piece) {
+        json_write_string (out, (const guint8 *) data + i,
+                           MIN (piece, len - i));
+    }
+    fclose (out);
+
+    g_file_get_contents (path, &contents, NULL, &error);
+    g_assert_no_error (error);
+    g_free (path);
+
+    return contents;
+}
+
+static void
+check (const gchar *data,
+       gsize        len,
+       const gchar *expected)
+{
+    gsize  piece;
+    gchar *got;
+
+    for (piece = MAX (len, 1); piece; --piece) {
+        got = escape (data, len, piece);
+        g_assert_cmpstr (got, ==, expected);
+        g_free (got);
+    }
+}
+
+/* Literals may hold NULs */
+#define CHECK(data, expected) check (data, sizeof (data) - 1, expected)
+
+static void
+test_plain (void)
+{
+    CHECK ("", "");
+    CHECK ("Prelude> 1 + 1", "Prelude> 1 + 1");
+
+    /* UTF-8 passes through as it is */
+    CHECK ("\xce\xbb x -> x", "\xce\xbb x -> x");
+}
+
+static void
+test_escapes (void)
+{
+    CHECK ("\"a\\b\"\n\r\t", "\\\"a\\\\b\\\"\\n\\r\\t");
+    CHECK ("\0\033[0m\x1f", "\\u0000\\u001b[0m\\u001f");
+}
+
+void
+test_json_add (void)
+{
+    g_test_add_func ("/json/plain", test_plain);
+    g_test_add_func ("/json/escapes", test_escapes);
+}
@@ -0,0 +1,60 @@
+#include <glib/gstdio.h>
+#include "tests.h"
+
+static gchar *_tmp_dir = NULL;
+
+/**
+ * A path in a directory of its own for this run, removed at exit along
+ * with whatever the tests left in it.
+ */
+gchar *
+test_tmp_path (const gchar *name)
+{
+    return g_build_filename (_tmp_dir, name, NULL);
+}
+
+static void
+remove_tmp_dir (void)
+{
+    GDir        *dir = g_dir_open (_tmp_dir, 0, NULL);
+    const gchar *name;
+    gchar       *path;
+
+    while (dir && (name = g_dir_read_name (dir))) {
+        path = test_tmp_path (name);
+        g_unlink (path);
+        g_free (path);
+    }
+    if (dir) {
+        g_dir_close (dir);
+    }
+    g_rmdir (_tmp_dir);
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+    GError *error = NULL;
+    int     status;
+
+    g_test_init (&argc, &argv, NULL);
+
+    _tmp_dir = g_dir_make_tmp ("gtk-ghci-tests-XXXXXX", &error);
+    g_assert_no_error (error);
+
+    test_record_add ();
+    test_ansi_add ();
+    test_transcript_add ();
+    test_json_add ();
+    test_cache_add ();
+    test_wordindex_add ();
+    test_utf8_add ();
+
+    status = g_test_run ();
+
+    remove_tmp_dir ();
+    g_free (_tmp_dir);
+
+    return status;
+}
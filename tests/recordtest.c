@@ -0,0 +1,96 @@
+#include <string.h>
+#include <glib/gstdio.h>
+#include "tests.h"
+#include "record.h"
+
+static void
+test_round_trip (void)
+{
+    GError       *error = NULL;
+    gchar        *path  = test_tmp_path ("round-trip.rec");
+    pio_recorder *rec;
+    pio_record    r;
+
+    rec = recorder_open (path, &error);
+    g_assert_no_error (error);
+    recorder_write (rec, 0, (const guint8 *) "Prelude> ", 9);
+    recorder_write (rec, 1, (const guint8 *) "", 0);
+    recorder_write (rec, 1, (const guint8 *) "\0\xff", 2);
+    recorder_close (rec);
+
+    rec = record_reader_open (path, &error);
+    g_assert_no_error (error);
+
+    g_assert_true (record_reader_next (rec, &r));
+    g_assert_cmpuint (r.stream, ==, 0);
+    g_assert_cmpmem (r.data, r.length, "Prelude> ", 9);
+    g_assert_cmpint (r.timestamp, >=, 0);
+
+    g_assert_true (record_reader_next (rec, &r));
+    g_assert_cmpuint (r.stream, ==, 1);
+    g_assert_cmpuint (r.length, ==, 0);
+
+    g_assert_true (record_reader_next (rec, &r));
+    g_assert_cmpmem (r.data, r.length, "\0\xff", 2);
+
+    g_assert_false (record_reader_next (rec, &r));
+    recorder_close (rec);
+    g_free (path);
+}
+
+static void
+test_truncated (void)
+{
+    GError       *error = NULL;
+    gchar        *path  = test_tmp_path ("truncated.rec"),
+                 *contents;
+    gsize         len;
+    pio_recorder *rec;
+    pio_record    r;
+
+    rec = recorder_open (path, &error);
+    g_assert_no_error (error);
+    recorder_write (rec, 0, (const guint8 *) "first", 5);
+    recorder_write (rec, 0, (const guint8 *) "second", 6);
+    recorder_close (rec);
+
+    /* Cut into the payload of the second record */
+    g_file_get_contents (path, &contents, &len, &error);
+    g_assert_no_error (error);
+    g_file_set_contents (path, contents, len - 3, &error);
+    g_assert_no_error (error);
+    g_free (contents);
+
+    rec = record_reader_open (path, &error);
+    g_assert_no_error (error);
+    g_assert_true (record_reader_next (rec, &r));
+    g_assert_cmpmem (r.data, r.length, "first", 5);
+    g_assert_false (record_reader_next (rec, &r));
+    recorder_close (rec);
+    g_free (path);
+}
+
+static void
+test_bad_magic (void)
+{
+    GError       *error = NULL;
+    gchar        *path  = test_tmp_path ("bad-magic.rec");
+    pio_recorder *rec;
+
+    g_file_set_contents (path, "GGHCREC0", -1, &error);
+    g_assert_no_error (error);
+
+    rec = record_reader_open (path, &error);
+    g_assert_null (rec);
+    g_assert_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL);
+    g_error_free (error);
+    g_free (path);
+}
+
+void
+test_record_add (void)
+{
+    g_test_add_func ("/record/round-trip", test_round_trip);
+    g_test_add_func ("/record/truncated", test_truncated);
+    g_test_add_func ("/record/bad-magic", test_bad_magic);
+}
@@ -0,0 +1,21 @@
+#ifndef TESTS_H
+#define TESTS_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Each module's tests, added to the GTest tree under /<module>/ */
+void test_record_add     (void);
+void test_ansi_add       (void);
+void test_transcript_add (void);
+void test_json_add       (void);
+void test_cache_add      (void);
+void test_wordindex_add  (void);
+void test_utf8_add       (void);
+
+gchar *test_tmp_path (const gchar *name);
+
+G_END_DECLS
+
+#endif /* TESTS_H */
@@ -0,0 +1,30 @@
+TEMPLATE = app
+CONFIG += console
+CONFIG -= app_bundle
+CONFIG -= qt
+
+# Unit tests of the modules that need no display: qmake && make && ./tests
+TARGET = tests
+
+INCLUDEPATH += ..
+
+SOURCES += main.c \
+    recordtest.c \
+    ansitest.c \
+    transcripttest.c \
+    jsontest.c \
+    cachetest.c \
+    wordindextest.c \
+    utf8test.c \
+    ../record.c \
+    ../ansi.c \
+    ../transcript.c \
+    ../json.c \
+    ../cache.c \
+    ../wordindex.c \
+    ../utf8.c
+
+HEADERS += tests.h
+
+CONFIG += link_pkgconfig
+PKGCONFIG += gtk+-3.0
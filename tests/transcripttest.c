@@ -0,0 +1,104 @@
+#include <string.h>
+#include "tests.h"
+#include "transcript.h"
+
+static void
+append (transcript  *t,
+        const gchar *text)
+{
+    transcript_append (t, text, strlen (text));
+}
+
+static void
+test_lines (void)
+{
+    transcript *t = transcript_new ();
+
+    /* "\n", "\r\n", a lone "\r" and U+2029 each end one line */
+    append (t, "a\nb\r\nc\rd\xe2\x80\xa9" "e");
+    g_assert_cmpuint (transcript_line_at (t, 0), ==, 0);
+    g_assert_cmpuint (transcript_line_at (t, 2), ==, 1);
+    g_assert_cmpuint (transcript_line_at (t, 5), ==, 2);
+    g_assert_cmpuint (transcript_line_at (t, 7), ==, 3);
+    g_assert_cmpuint (transcript_line_at (t, 11), ==, 4);
+    g_assert_cmpuint (transcript_line_start (t, 4), ==, 11);
+    g_assert_cmpuint (transcript_line_start (t, 99), ==, 11);
+
+    /* "\r\n" split between appends */
+    append (t, "\r");
+    append (t, "\nf");
+    g_assert_cmpuint (transcript_line_at (t, 14), ==, 5);
+    g_assert_cmpuint (transcript_line_start (t, 5), ==, 14);
+    g_assert_cmpuint (transcript_line_start (t, 6), ==, 14);
+
+    transcript_unref (t);
+}
+
+static void
+test_find (void)
+{
+    transcript *t = transcript_new ();
+    gchar      *fill = g_strnfill (TRANSCRIPT_CHUNK_SIZE - 3, 'x');
+    guint64     match;
+
+    append (t, fill);
+    append (t, "needle");
+    append (t, fill);
+    append (t, "needle");
+    g_assert_cmpuint (transcript_get_length (t), ==,
+                      2 * (TRANSCRIPT_CHUNK_SIZE - 3 + 6));
+
+    /* Straddling the seam of the first two chunks */
+    g_assert_true (transcript_find (t, "needle", 6, 0, G_MAXUINT64, &match));
+    g_assert_cmpuint (match, ==, TRANSCRIPT_CHUNK_SIZE - 3);
+
+    g_assert_true (transcript_find (t, "needle", 6, match + 1, G_MAXUINT64,
+                                    &match));
+    g_assert_cmpuint (match, ==, 2 * TRANSCRIPT_CHUNK_SIZE);
+
+    /* A match must end at or before to */
+    g_assert_false (transcript_find (t, "needle", 6, match + 1,
+                                     transcript_get_length (t), &match));
+    g_assert_false (transcript_find (t, "needle", 6, 0,
+                                     TRANSCRIPT_CHUNK_SIZE + 2, &match));
+
+    g_free (fill);
+    transcript_unref (t);
+}
+
+static void
+test_commands (void)
+{
+    transcript         *t = transcript_new ();
+    transcript_command  cmd;
+
+    append (t, "Prelude> ");
+    transcript_begin_command (t);
+    append (t, "1 + 1\n");
+    transcript_begin_output (t);
+    append (t, "2\n");
+
+    g_assert_true (transcript_get_command (t, 0, &cmd));
+    g_assert_cmpuint (cmd.input, ==, 9);
+    g_assert_cmpuint (cmd.output, ==, 15);
+    g_assert_cmpuint (cmd.end, ==, G_MAXUINT64);
+
+    transcript_end_command (t);
+    append (t, "Prelude> ");
+    transcript_end_command (t);
+
+    g_assert_true (transcript_get_command (t, 0, &cmd));
+    g_assert_cmpuint (cmd.end, ==, 17);
+    g_assert_cmpint (cmd.finished, >=, cmd.started);
+    g_assert_false (transcript_get_command (t, 1, &cmd));
+
+    transcript_unref (t);
+}
+
+void
+test_transcript_add (void)
+{
+    g_test_add_func ("/transcript/lines", test_lines);
+    g_test_add_func ("/transcript/find", test_find);
+    g_test_add_func ("/transcript/commands", test_commands);
+}
@@ -0,0 +1,141 @@
+#include <string.h>
+#include "tests.h"
+#include "utf8.h"
+
+#define R UTF8_REPLACEMENT
+
+/* What a reader shows of data fed in pieces of at most piece bytes, up to
+ * the end of the stream */
+static gchar *
+stream (const gchar *data,
+        gsize        len,
+        gsize        piece,
+        guint64     *replaced)
+{
+    utf8_stream  u;
+    GString     *scratch = g_string_new (NULL),
+                *out     = g_string_new (NULL);
+    const gchar *text;
+    gsize        i,
+                 n;
+
+    utf8_stream_init (&u);
+    for (i = 0; i < len; i += piece) {
+        text = utf8_stream_feed (&u, (const guint8 *) data + i,
+                                 MIN (piece, len - i), scratch, &n);
+        g_assert_true (g_utf8_validate (text, n, NULL));
+        g_string_append_len (out, text, n);
+    }
+    text = utf8_stream_finish (&u, scratch, &n);
+    g_string_append_len (out, text, n);
+
+    *replaced = u.replaced;
+    g_string_free (scratch, TRUE);
+    return g_string_free (out, FALSE);
+}
+
+static void
+check (const gchar *data,
+       gsize        len,
+       const gchar *expected,
+       guint64      replacements)
+{
+    guint64 replaced;
+    gsize   piece;
+    gchar  *got;
+
+    for (piece = MAX (len, 1); piece; --piece) {
+        got = stream (data, len, piece, &replaced);
+        g_assert_cmpstr (got, ==, expected);
+        g_assert_cmpuint (replaced, ==, replacements);
+        g_free (got);
+    }
+}
+
+/* Literals may hold NULs */
+#define CHECK(data, expected, n) check (data, sizeof (data) - 1, expected, n)
+
+static void
+test_valid (void)
+{
+    CHECK ("", "", 0);
+    CHECK ("Prelude> map toUpper \"abc\"", "Prelude> map toUpper \"abc\"", 0);
+
+    /* Two, three and four byte sequences, cut everywhere in turn */
+    CHECK ("\xce\xbb x -> \xe2\x88\x80 \xf0\x9d\x94\xb8",
+           "\xce\xbb x -> \xe2\x88\x80 \xf0\x9d\x94\xb8", 0);
+
+    /* Long enough for the word at a time scan */
+    CHECK ("0123456789abcdef0123456789abcdef\xc3\xa9",
+           "0123456789abcdef0123456789abcdef\xc3\xa9", 0);
+}
+
+static void
+test_overlong (void)
+{
+    /* Each byte that cannot start or continue a sequence is replaced */
+    CHECK ("<\xc0\xaf>", "<" R R ">", 2);
+    CHECK ("<\xe0\x80\xaf>", "<" R R R ">", 3);
+    CHECK ("<\xf0\x82\x82\xac>", "<" R R R R ">", 4);
+}
+
+static void
+test_surrogate (void)
+{
+    CHECK ("<\xed\xa0\x80>", "<" R R R ">", 3);
+    CHECK ("<\xed\xbf\xbf\xed\x9f\xbf>", "<" R R R "\xed\x9f\xbf>", 3);
+
+    /* Past U+10FFFF */
+    CHECK ("<\xf4\x90\x80\x80>", "<" R R R R ">", 4);
+}
+
+static void
+test_truncated (void)
+{
+    /* The valid prefix of a cut sequence is replaced once, as a whole */
+    CHECK ("<\xe2\x82>", "<" R ">", 1);
+    CHECK ("<\xf0\x9d\x94 \xc3", "<" R " " R, 2);
+}
+
+static void
+test_prompt (void)
+{
+    static const guint8 lambda[] = "\xce\xbb";
+    utf8_stream         u;
+    GString            *scratch = g_string_new (NULL);
+    const gchar        *text;
+    gsize               n;
+
+    /* Output cut mid-sequence, by an interrupt, before the prompt */
+    utf8_stream_init (&u);
+    text = utf8_stream_feed (&u, (const guint8 *) "ab\xe2\x88", 4,
+                             scratch, &n);
+    g_assert_cmpmem (text, n, "ab", 2);
+
+    /* The prompt ends the output: what was held back will not complete */
+    text = utf8_stream_finish (&u, scratch, &n);
+    g_assert_cmpmem (text, n, R, strlen (R));
+    text = utf8_stream_finish (&u, scratch, &n);
+    g_assert_cmpuint (n, ==, 0);
+
+    /* So the next output starts clean, and is passed through as it is */
+    text = utf8_stream_feed (&u, (const guint8 *) "\x80Prelude> ", 10,
+                             scratch, &n);
+    g_assert_cmpmem (text, n, R "Prelude> ", strlen (R) + 9);
+    text = utf8_stream_feed (&u, lambda, 2, scratch, &n);
+    g_assert_true (text == (const gchar *) lambda);
+    g_assert_cmpuint (n, ==, 2);
+    g_assert_cmpuint (u.replaced, ==, 2);
+
+    g_string_free (scratch, TRUE);
+}
+
+void
+test_utf8_add (void)
+{
+    g_test_add_func ("/utf8/valid", test_valid);
+    g_test_add_func ("/utf8/overlong", test_overlong);
+    g_test_add_func ("/utf8/surrogate", test_surrogate);
+    g_test_add_func ("/utf8/truncated", test_truncated);
+    g_test_add_func ("/utf8/prompt", test_prompt);
+}
@@ -0,0 +1,146 @@
+#include <string.h>
+#include "tests.h"
+#include "wordindex.h"
+
+/* The names word_index_parse () finds in text, space separated, sorted */
+static gchar *
+parse (const gchar *text)
+{
+    GPtrArray  *words = g_ptr_array_new_with_free_func (g_free);
+    GString    *out   = g_string_new (NULL);
+    gchar      *path  = test_tmp_path ("parse.idx");
+    GError     *error = NULL;
+    word_index *idx;
+    guint       i;
+
+    word_index_parse (text, words);
+    word_index_write (path, words, &error);
+    g_assert_no_error (error);
+
+    idx = word_index_open (path, &error);
+    g_assert_no_error (error);
+    for (i = 0; i < word_index_count (idx); ++i) {
+        g_string_append_printf (out, "%s%s", i ? " " : "",
+                                word_index_get (idx, i));
+    }
+
+    word_index_free (idx);
+    g_ptr_array_free (words, TRUE);
+    g_free (path);
+
+    return g_string_free (out, FALSE);
+}
+
+static void
+check (const gchar *text,
+       const gchar *expected)
+{
+    gchar *got = parse (text);
+
+    g_assert_cmpstr (got, ==, expected);
+    g_free (got);
+}
+
+static void
+test_signatures (void)
+{
+    check ("(++) :: [a] -> [a] -> [a]\n"
+           "curry, uncurry' :: a\n"
+           "GHC.Base.map :: (a -> b) -> [a] -> [b]\n"
+           "-- imported via Prelude\n",
+           "curry map uncurry'");
+
+    /* The first prompt comes before :set prompt takes effect */
+    check ("GHCi, version 9.4.7: https://www.haskell.org/ghc/  :? for help\n"
+           "Prelude> id :: a -> a\n", "id");
+    check ("ghci> id :: a -> a\n", "id");
+}
+
+static void
+test_types (void)
+{
+    check ("class Functor f => Applicative f where\n"
+           "  pure :: a -> f a\n"
+           "type String = [Char]\n"
+           "type family Item l\n"
+           "data IO a\n",
+           "Applicative IO Item String pure");
+}
+
+static void
+test_constructors (void)
+{
+    check ("data Maybe a = Nothing | Just a\n"
+           "newtype Sum a = Sum {getSum :: a}\n"
+           "data P = P {pair :: (Int, Int), name, note :: String}\n"
+           "data Ex = forall a. Show a => Ex a | (:+) Int Int\n",
+           "Ex Just Maybe Nothing P Sum getSum name note pair");
+
+    /* Long declarations are broken over lines */
+    check ("data IOMode\n"
+           "  = ReadMode | WriteMode\n"
+           "  | AppendMode\n"
+           "data Rec\n"
+           "  = Rec {first :: Int,\n"
+           "         second :: Int}\n"
+           "type Alias\n"
+           "  = Int\n",
+           "Alias AppendMode IOMode ReadMode Rec WriteMode first second");
+}
+
+static void
+test_range (void)
+{
+    GPtrArray  *words = g_ptr_array_new_with_free_func (g_free);
+    gchar      *path  = test_tmp_path ("range.idx");
+    GError     *error = NULL;
+    word_index *idx;
+    guint       first,
+                last;
+
+    word_index_parse ("map :: a\nmapM :: a\nmapM_ :: a\nmax :: a\n"
+                      "data Map k a\nmap :: a\n", words);
+    word_index_write (path, words, &error);
+    g_assert_no_error (error);
+    idx = word_index_open (path, &error);
+    g_assert_no_error (error);
+
+    /* Duplicates are dropped */
+    g_assert_cmpuint (word_index_count (idx), ==, 5);
+
+    g_assert_true (word_index_range (idx, "map", &first, &last));
+    g_assert_cmpstr (word_index_get (idx, first), ==, "map");
+    g_assert_cmpuint (last - first, ==, 3);
+    g_assert_true (word_index_range (idx, "ma", &first, &last));
+    g_assert_cmpuint (last - first, ==, 4);
+    g_assert_false (word_index_range (idx, "mb", &first, &last));
+
+    word_index_free (idx);
+    g_ptr_array_free (words, TRUE);
+    g_free (path);
+}
+
+static void
+test_invalid (void)
+{
+    gchar  *path  = test_tmp_path ("invalid.idx");
+    GError *error = NULL;
+
+    g_file_set_contents (path, "GGHCIDX1\0\0", 10, &error);
+    g_assert_no_error (error);
+    g_assert_null (word_index_open (path, &error));
+    g_assert_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL);
+
+    g_clear_error (&error);
+    g_free (path);
+}
+
+void
+test_wordindex_add (void)
+{
+    g_test_add_func ("/wordindex/signatures", test_signatures);
+    g_test_add_func ("/wordindex/types", test_types);
+    g_test_add_func ("/wordindex/constructors", test_constructors);
+    g_test_add_func ("/wordindex/range", test_range);
+    g_test_add_func ("/wordindex/invalid", test_invalid);
+}
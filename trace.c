@@ -0,0 +1,237 @@
+#include "trace.h"
+
+#ifdef ENABLE_TRACE
+
+#include <stdio.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
+
+typedef struct _trace_ring trace_ring;
+
+/* A ring is written by its own thread only, and read by whichever thread
+ * dumps it, without stopping the writer. head is published after each
+ * record is written, and a dump keeps only the records it copied that the
+ * writer cannot have touched meanwhile. */
+struct _trace_ring
+{
+    trace_record  records[TRACE_RING_SIZE];
+    guint64       head;         /* Total number of records ever written */
+    guint         tid;
+};
+
+static GPrivate  _ring_key   = G_PRIVATE_INIT (NULL);
+static GMutex    _rings_lock;
+static GSList   *_rings      = NULL;
+static guint     _next_tid   = 1;
+static gint      _dump_count = 0;
+
+static trace_ring *
+ring_get (void)
+{
+    trace_ring *ring = g_private_get (&_ring_key);
+
+    if (G_UNLIKELY (!ring)) {
+        /* Rings are never freed: a dump may still need the records of a
+         * thread that has since exited. */
+        ring = g_malloc0 (sizeof (trace_ring));
+
+        g_mutex_lock (&_rings_lock);
+        ring->tid = _next_tid++;
+        _rings = g_slist_prepend (_rings, ring);
+        g_mutex_unlock (&_rings_lock);
+
+        g_private_set (&_ring_key, ring);
+    }
+    return ring;
+}
+
+void
+trace_emit (const gchar *name,
+            gchar        phase,
+            gint64       value)
+{
+    trace_ring   *ring = ring_get ();
+    guint64       head = ring->head;
+    trace_record *rec  = &ring->records[head & (TRACE_RING_SIZE - 1)];
+
+    /* The slot is overwritten only after the last head is visible: a dump
+     * that copies the new record also sees that its old one is gone */
+    __atomic_thread_fence (__ATOMIC_RELEASE);
+
+    rec->ts    = g_get_monotonic_time ();
+    rec->name  = name;
+    rec->value = value;
+    rec->phase = phase;
+
+    __atomic_store_n (&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Copy the records of a ring that may be being written to. Returns the
+ * index of the first record that is intact in the copy; *end is one past
+ * the last.
+ */
+static guint64
+snapshot_ring (trace_ring   *ring,
+               trace_record *copy,
+               guint64      *end)
+{
+    guint64 before,
+            after;
+
+    before = __atomic_load_n (&ring->head, __ATOMIC_ACQUIRE);
+    memcpy (copy, ring->records, sizeof (ring->records));
+    __atomic_thread_fence (__ATOMIC_ACQUIRE);
+    after  = __atomic_load_n (&ring->head, __ATOMIC_RELAXED);
+
+    /* The writer got as far as record after, overwriting the slots of the
+     * records up to after - TRACE_RING_SIZE while the copy was made */
+    *end = before;
+    if (after + 1 > TRACE_RING_SIZE) {
+        return MIN (after + 1 - TRACE_RING_SIZE, before);
+    }
+    return 0;
+}
+
+static void
+dump_ring (FILE         *file,
+           trace_ring   *ring,
+           trace_record *copy,
+           gboolean     *first)
+{
+    guint64 end,
+            i   = snapshot_ring (ring, copy, &end);
+    pid_t   pid = getpid ();
+
+    for (; i < end; ++i) {
+        trace_record *rec = &copy[i & (TRACE_RING_SIZE - 1)];
+
+        fprintf (file, "%s\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%" G_GINT64_FORMAT
+                       ",\"pid\":%d,\"tid\":%u",
+                 *first ? "" : ",", rec->name, rec->phase, rec->ts,
+                 (gint) pid, ring->tid);
+
+        switch (rec->phase)
+        {
+        case 'C':
+            fprintf (file, ",\"args\":{\"value\":%" G_GINT64_FORMAT "}}",
+                     rec->value);
+            break;
+        case 'i':
+            fprintf (file, ",\"s\":\"t\",\"args\":{\"value\":%" G_GINT64_FORMAT "}}",
+                     rec->value);
+            break;
+        default:
+            fputc ('}', file);
+            break;
+        }
+        *first = FALSE;
+    }
+}
+
+/**
+ * Write the contents of every thread's ring buffer to path, in the Chrome
+ * trace event JSON format understood by chrome://tracing and Perfetto. Safe
+ * to call from any thread while the others go on recording.
+ */
+gboolean
+trace_dump (const gchar  *path,
+            GError      **error)
+{
+    FILE         *file;
+    GSList       *iter;
+    trace_record *copy;
+    gboolean      first = TRUE;
+
+    file = g_fopen (path, "w");
+    if (!file) {
+        g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+                     "%s: %s", path, g_strerror (errno));
+        return FALSE;
+    }
+
+    fputs ("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", file);
+
+    copy = g_new (trace_record, TRACE_RING_SIZE);
+    g_mutex_lock (&_rings_lock);
+    for (iter = _rings; iter; iter = iter->next) {
+        dump_ring (file, iter->data, copy, &first);
+    }
+    g_mutex_unlock (&_rings_lock);
+    g_free (copy);
+
+    fputs ("\n]}\n", file);
+
+    if (fclose (file)) {
+        g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+                     "%s: %s", path, g_strerror (errno));
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/**
+ * Dump to a fresh file in the temporary directory. Returns the path written,
+ * or NULL on failure.
+ */
+gchar *
+trace_dump_auto (void)
+{
+    GError *error = NULL;
+    gchar  *name,
+           *path;
+
+    name = g_strdup_printf ("gtk-ghci-trace-%d-%u.json",
+                            (gint) getpid (),
+                            (guint) g_atomic_int_add (&_dump_count, 1) + 1);
+    path = g_build_filename (g_get_tmp_dir (), name, NULL);
+    g_free (name);
+
+    if (!trace_dump (path, &error)) {
+        g_warning ("%s", error->message);
+        g_error_free (error);
+        g_free (path);
+        return NULL;
+    }
+
+    g_message ("Trace written to %s", path);
+    return path;
+}
+
+static gpointer
+dump_thread (sigset_t *set)
+{
+    gint sig;
+
+    /* Not a main loop callback: a dump must work while the GUI is stuck */
+    for (;;) {
+        if (!sigwait (set, &sig)) {
+            g_free (trace_dump_auto ());
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Start a thread that dumps the trace buffers on SIGUSR1. The signal is
+ * blocked in the calling thread, so this must run before any other thread
+ * is started, for them to inherit the mask.
+ */
+void
+trace_init (void)
+{
+    static sigset_t set;
+
+    sigemptyset (&set);
+    sigaddset (&set, SIGUSR1);
+    pthread_sigmask (SIG_BLOCK, &set, NULL);
+
+    g_thread_unref (g_thread_new ("trace-dump", (GThreadFunc) dump_thread,
+                                  &set));
+}
+
+#endif /* ENABLE_TRACE */
@@ -0,0 +1,53 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Static tracepoints. Build with ENABLE_TRACE defined to record them into a
+ * per-thread ring buffer; otherwise every macro below expands to nothing.
+ *
+ * Event names must be string literals (only the pointer is recorded).
+ */
+
+#ifdef ENABLE_TRACE
+
+#define TRACE_RING_SIZE 65536   /* Records per thread, power of two */
+
+typedef struct _trace_record trace_record;
+
+struct _trace_record
+{
+    gint64        ts;           /* Monotonic time in microseconds */
+    const gchar  *name;
+    gint64        value;        /* Counter value or instant argument */
+    gchar         phase;        /* Chrome trace phase: 'B', 'E', 'i', 'C' */
+};
+
+void      trace_init      (void);
+void      trace_emit      (const gchar *name, gchar phase, gint64 value);
+gboolean  trace_dump      (const gchar *path, GError **error);
+gchar    *trace_dump_auto (void);
+
+#define TRACE_INIT()                trace_init ()
+#define TRACE_BEGIN(name)           trace_emit ((name), 'B', 0)
+#define TRACE_END(name)             trace_emit ((name), 'E', 0)
+#define TRACE_INSTANT(name, value)  trace_emit ((name), 'i', (value))
+#define TRACE_COUNTER(name, value)  trace_emit ((name), 'C', (value))
+#define TRACE_DUMP()                g_free (trace_dump_auto ())
+
+#else
+
+#define TRACE_INIT()                G_STMT_START { } G_STMT_END
+#define TRACE_BEGIN(name)           G_STMT_START { } G_STMT_END
+#define TRACE_END(name)             G_STMT_START { } G_STMT_END
+#define TRACE_INSTANT(name, value)  G_STMT_START { } G_STMT_END
+#define TRACE_COUNTER(name, value)  G_STMT_START { } G_STMT_END
+#define TRACE_DUMP()                G_STMT_START { } G_STMT_END
+
+#endif /* ENABLE_TRACE */
+
+G_END_DECLS
+
+#endif /* TRACE_H */
@@ -0,0 +1,323 @@
+#define _GNU_SOURCE
+#include <string.h>
+#include "transcript.h"
+
+transcript *
+transcript_new (void)
+{
+    transcript *t = g_malloc0 (sizeof (transcript));
+    guint64     zero = 0;
+
+    t->chunks = g_ptr_array_new_with_free_func (g_free);
+    t->lines  = g_array_new (FALSE, FALSE, sizeof (guint64));
+    g_array_append_val (t->lines, zero);
+
+    t->commands  = g_array_new (FALSE, FALSE, sizeof (transcript_command));
+    t->ref_count = 1;
+    g_mutex_init (&t->lock);
+
+    return t;
+}
+
+/**
+ * Record the line starts in data, which goes at offset. Lines end where
+ * GtkTextBuffer ends them, at "\n", "\r", "\r\n" and U+2029, so that
+ * line numbers here and in the view agree.
+ */
+static void
+index_lines (transcript    *t,
+             const guint8  *data,
+             gsize          len,
+             guint64        offset)
+{
+    guint64 start;
+    gsize   i;
+
+    if (t->cr && len && '\n' == data[0]) {
+        /* "\r\n" split between two appends is still one break */
+        g_array_index (t->lines, guint64, t->lines->len - 1) = offset + 1;
+        data   += 1;
+        len    -= 1;
+        offset += 1;
+    }
+
+    for (i = 0; i < len; ++i) {
+        switch (data[i])
+        {
+        case '\r':
+            if (i + 1 < len && '\n' == data[i + 1]) {
+                ++i;
+            }
+            break;
+        case '\n':
+            break;
+        case 0xe2:
+            /* U+2029 PARAGRAPH SEPARATOR */
+            if (i + 2 < len && 0x80 == data[i + 1] && 0xa9 == data[i + 2]) {
+                i += 2;
+                break;
+            }
+            continue;
+        default:
+            continue;
+        }
+        start = offset + i + 1;
+        g_array_append_val (t->lines, start);
+    }
+
+    if (len) {
+        t->cr = '\r' == data[len - 1];
+    }
+}
+
+void
+transcript_append (transcript   *t,
+                   const gchar  *data,
+                   gsize         len)
+{
+    gsize   off,
+            n;
+    guint8 *chunk;
+
+    g_mutex_lock (&t->lock);
+
+    /* Before the text is cut into chunks, which may split a separator */
+    index_lines (t, (const guint8 *) data, len, t->length);
+
+    while (len) {
+        off = t->length % TRANSCRIPT_CHUNK_SIZE;
+        if (!off) {
+            g_ptr_array_add (t->chunks, g_malloc (TRANSCRIPT_CHUNK_SIZE));
+        }
+        chunk = g_ptr_array_index (t->chunks, t->chunks->len - 1);
+
+        n = MIN (len, TRANSCRIPT_CHUNK_SIZE - off);
+        memcpy (chunk + off, data, n);
+
+        t->length += n;
+        data      += n;
+        len       -= n;
+    }
+
+    g_mutex_unlock (&t->lock);
+}
+
+/**
+ * Line number containing the byte at offset.
+ */
+guint
+transcript_line_at (transcript *t,
+                    guint64     offset)
+{
+    guint lo = 0,
+          hi = t->lines->len;
+
+    /* Find the last line starting at or before offset */
+    while (hi - lo > 1) {
+        guint mid = lo + (hi - lo) / 2;
+
+        if (g_array_index (t->lines, guint64, mid) <= offset) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+guint64
+transcript_line_start (transcript *t,
+                       guint       line)
+{
+    return g_array_index (t->lines, guint64, MIN (line, t->lines->len - 1));
+}
+
+/**
+ * Find the first occurrence of needle starting in [from, to - nlen]. The
+ * chunks are scanned in place with memmem; only matches straddling two
+ * chunks need a copy of the seam.
+ */
+gboolean
+transcript_find (transcript   *t,
+                 const gchar  *needle,
+                 gsize         nlen,
+                 guint64       from,
+                 guint64       to,
+                 guint64      *match)
+{
+    const guint8 *chunk,
+                 *hit;
+    guint8       *seam;
+    gsize         off,
+                  avail,
+                  head,
+                  tail;
+
+    to = MIN (to, t->length);
+
+    while (nlen && from + nlen <= to) {
+        chunk = g_ptr_array_index (t->chunks, from / TRANSCRIPT_CHUNK_SIZE);
+        off   = from % TRANSCRIPT_CHUNK_SIZE;
+        avail = MIN (TRANSCRIPT_CHUNK_SIZE - off, to - from);
+
+        hit = memmem (chunk + off, avail, needle, nlen);
+        if (hit) {
+            *match = from + (hit - (chunk + off));
+            return TRUE;
+        }
+
+        if (nlen > 1 && avail < to - from) {
+            /* Search the seam between this chunk and the next */
+            head = MIN (nlen - 1, avail);
+            tail = MIN (nlen - 1, to - from - avail);
+            seam = g_malloc (head + tail);
+
+            memcpy (seam, chunk + off + avail - head, head);
+            memcpy (seam + head,
+                    g_ptr_array_index (t->chunks,
+                                       from / TRANSCRIPT_CHUNK_SIZE + 1),
+                    tail);
+
+            hit = memmem (seam, head + tail, needle, nlen);
+            if (hit) {
+                *match = from + avail - head + (hit - seam);
+            }
+            g_free (seam);
+
+            if (hit) {
+                return TRUE;
+            }
+        }
+
+        from += avail;
+    }
+    return FALSE;
+}
+
+guint64
+transcript_get_length (transcript *t)
+{
+    guint64 length;
+
+    g_mutex_lock (&t->lock);
+    length = t->length;
+    g_mutex_unlock (&t->lock);
+
+    return length;
+}
+
+/**
+ * Point data at the text starting at offset. Returns the number of
+ * contiguous bytes available there, up to to. Safe to call from any thread
+ * for offsets below a previously read length.
+ */
+gsize
+transcript_peek (transcript    *t,
+                 guint64        offset,
+                 guint64        to,
+                 const guint8 **data)
+{
+    gsize off = offset % TRANSCRIPT_CHUNK_SIZE;
+
+    if (offset >= to) {
+        return 0;
+    }
+
+    g_mutex_lock (&t->lock);
+    *data = (const guint8 *) g_ptr_array_index (t->chunks,
+                                                offset / TRANSCRIPT_CHUNK_SIZE)
+            + off;
+    g_mutex_unlock (&t->lock);
+
+    return MIN (TRANSCRIPT_CHUNK_SIZE - off, to - offset);
+}
+
+/**
+ * Start a command record. The echoed input is expected to be appended next,
+ * followed by transcript_begin_output ().
+ */
+void
+transcript_begin_command (transcript *t)
+{
+    transcript_command cmd;
+
+    g_mutex_lock (&t->lock);
+
+    cmd.input    = t->length;
+    cmd.output   = t->length;
+    cmd.end      = G_MAXUINT64;
+    cmd.started  = g_get_monotonic_time ();
+    cmd.finished = 0;
+    g_array_append_val (t->commands, cmd);
+
+    g_mutex_unlock (&t->lock);
+}
+
+void
+transcript_begin_output (transcript *t)
+{
+    g_mutex_lock (&t->lock);
+    if (t->commands->len) {
+        g_array_index (t->commands, transcript_command,
+                       t->commands->len - 1).output = t->length;
+    }
+    g_mutex_unlock (&t->lock);
+}
+
+/**
+ * Close the running command record, if any.
+ */
+void
+transcript_end_command (transcript *t)
+{
+    transcript_command *cmd;
+
+    g_mutex_lock (&t->lock);
+    if (t->commands->len) {
+        cmd = &g_array_index (t->commands, transcript_command,
+                              t->commands->len - 1);
+        if (G_MAXUINT64 == cmd->end) {
+            cmd->end      = t->length;
+            cmd->finished = g_get_monotonic_time ();
+        }
+    }
+    g_mutex_unlock (&t->lock);
+}
+
+gboolean
+transcript_get_command (transcript         *t,
+                        guint               index,
+                        transcript_command *command)
+{
+    gboolean found;
+
+    g_mutex_lock (&t->lock);
+    found = index < t->commands->len;
+    if (found) {
+        *command = g_array_index (t->commands, transcript_command, index);
+    }
+    g_mutex_unlock (&t->lock);
+
+    return found;
+}
+
+transcript *
+transcript_ref (transcript *t)
+{
+    g_atomic_int_inc (&t->ref_count);
+    return t;
+}
+
+void
+transcript_unref (transcript *t)
+{
+    if (!g_atomic_int_dec_and_test (&t->ref_count)) {
+        return;
+    }
+
+    g_ptr_array_free (t->chunks, TRUE);
+    g_array_free (t->lines, TRUE);
+    g_array_free (t->commands, TRUE);
+    g_mutex_clear (&t->lock);
+    g_free (t);
+}
@@ -0,0 +1,61 @@
+#ifndef TRANSCRIPT_H
+#define TRANSCRIPT_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+#define TRANSCRIPT_CHUNK_SIZE (256 * 1024)
+
+typedef struct _transcript transcript;
+typedef struct _transcript_command transcript_command;
+
+/* Append-only store holding the text of the output view, split into fixed
+ * size chunks, together with the byte offset of every line start.
+ *
+ * Chunks never move once written, so other threads may read the text below
+ * a length obtained from transcript_get_length () without holding the lock
+ * for longer than it takes to look a chunk up.
+ */
+struct _transcript
+{
+    GPtrArray  *chunks;         /* TRANSCRIPT_CHUNK_SIZE byte blocks */
+    guint64     length;
+    GArray     *lines;          /* guint64 offset of each line start */
+    gboolean    cr;             /* The text so far ends with '\r' */
+    GArray     *commands;       /* transcript_command */
+    GMutex      lock;           /* Guards chunks, length and commands */
+    gint        ref_count;
+};
+
+struct _transcript_command
+{
+    guint64     input,          /* Offset of the echoed input */
+                output,         /* Offset of the first byte of output */
+                end;            /* End of output, G_MAXUINT64 while running */
+    gint64      started,        /* Monotonic time */
+                finished;
+};
+
+transcript *transcript_new         (void);
+void        transcript_append      (transcript *t, const gchar *data,
+                                    gsize len);
+guint       transcript_line_at     (transcript *t, guint64 offset);
+guint64     transcript_line_start  (transcript *t, guint line);
+gboolean    transcript_find        (transcript *t, const gchar *needle,
+                                    gsize nlen, guint64 from, guint64 to,
+                                    guint64 *match);
+guint64     transcript_get_length  (transcript *t);
+gsize       transcript_peek        (transcript *t, guint64 offset,
+                                    guint64 to, const guint8 **data);
+void        transcript_begin_command (transcript *t);
+void        transcript_begin_output  (transcript *t);
+void        transcript_end_command   (transcript *t);
+gboolean    transcript_get_command (transcript *t, guint index,
+                                    transcript_command *command);
+transcript *transcript_ref         (transcript *t);
+void        transcript_unref       (transcript *t);
+
+G_END_DECLS
+
+#endif /* TRANSCRIPT_H */
@@ -9,7 +9,16 @@ init_ui (GtkWidget *window)
               *btn,
               *scrolled,
               *entry,
-              *view;
+              *hint,
+              *view,
+              *search_bar,
+              *search_box,
+              *search_entry,
+              *search_label,
+              *flood_bar,
+              *flood_box,
+              *flood_label,
+              *flood_tail;
 
     ui        *ui_struct;
 
@@ -22,6 +31,12 @@ init_ui (GtkWidget *window)
 
     entry = command_entry_new ();
 
+    hint = gtk_label_new (NULL);
+    gtk_label_set_ellipsize (GTK_LABEL (hint), PANGO_ELLIPSIZE_END);
+    gtk_label_set_max_width_chars (GTK_LABEL (hint), 40);
+    gtk_style_context_add_class (gtk_widget_get_style_context (hint),
+                                 "dim-label");
+
     view = gtk_text_view_new ();
     gtk_text_view_set_editable (GTK_TEXT_VIEW (view), FALSE);
     gtk_text_view_set_cursor_visible (GTK_TEXT_VIEW (view), FALSE);
@@ -29,12 +44,49 @@ init_ui (GtkWidget *window)
 
     font_desc = pango_font_description_from_string ("Monospace 8");
     gtk_widget_override_font (view, font_desc);
+
+    flood_label = gtk_label_new (NULL);
+    flood_tail  = gtk_label_new (NULL);
+    flood_box   = gtk_box_new (GTK_ORIENTATION_VERTICAL, 2);
+    flood_bar   = gtk_info_bar_new_with_buttons ("_Interrupt",
+                                                 GTK_RESPONSE_REJECT,
+                                                 "_Open", GTK_RESPONSE_ACCEPT,
+                                                 NULL);
+
+    gtk_widget_set_halign (flood_label, GTK_ALIGN_START);
+    gtk_widget_set_halign (flood_tail, GTK_ALIGN_START);
+    gtk_widget_override_font (flood_tail, font_desc);
     pango_font_description_free (font_desc);
 
+    gtk_box_pack_start (GTK_BOX (flood_box), flood_label, FALSE, FALSE, 0);
+    gtk_box_pack_start (GTK_BOX (flood_box), flood_tail, FALSE, FALSE, 0);
+    gtk_container_add (GTK_CONTAINER (gtk_info_bar_get_content_area (
+                                          GTK_INFO_BAR (flood_bar))),
+                       flood_box);
+    gtk_info_bar_set_message_type (GTK_INFO_BAR (flood_bar), GTK_MESSAGE_WARNING);
+    gtk_info_bar_set_show_close_button (GTK_INFO_BAR (flood_bar), TRUE);
+
+    /* Hidden until there is a flood */
+    gtk_widget_show_all (flood_box);
+    gtk_widget_set_no_show_all (flood_bar, TRUE);
+
     font_desc = pango_font_description_from_string ("Monospace 11");
     gtk_widget_override_font (entry, font_desc);
+    gtk_widget_override_font (hint, font_desc);
     pango_font_description_free (font_desc);
 
+    search_entry = gtk_search_entry_new ();
+    search_label = gtk_label_new (NULL);
+    search_box   = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 6);
+    search_bar   = gtk_search_bar_new ();
+
+    gtk_box_pack_start (GTK_BOX (search_box), search_entry, TRUE, TRUE, 0);
+    gtk_box_pack_start (GTK_BOX (search_box), search_label, FALSE, FALSE, 0);
+    gtk_container_add (GTK_CONTAINER (search_bar), search_box);
+    gtk_search_bar_connect_entry (GTK_SEARCH_BAR (search_bar),
+                                  GTK_ENTRY (search_entry));
+    gtk_search_bar_set_show_close_button (GTK_SEARCH_BAR (search_bar), TRUE);
+
     scrolled = gtk_scrolled_window_new (NULL, NULL);
     gtk_container_add (GTK_CONTAINER (scrolled), view);
 
@@ -44,10 +96,13 @@ init_ui (GtkWidget *window)
     gtk_button_set_label (GTK_BUTTON (btn), "Run");
 
     gtk_box_pack_start (GTK_BOX (hbox), entry, TRUE, TRUE, 0);
+    gtk_box_pack_start (GTK_BOX (hbox), hint, FALSE, FALSE, 6);
     gtk_box_pack_end (GTK_BOX (hbox), btn, FALSE, FALSE, 0);
 
+    gtk_box_pack_start (GTK_BOX (vbox), search_bar, FALSE, FALSE, 0);
     gtk_box_pack_start (GTK_BOX (vbox), scrolled, TRUE, TRUE, 0);
     gtk_box_pack_end (GTK_BOX (vbox), hbox, FALSE, FALSE, 0);
+    gtk_box_pack_end (GTK_BOX (vbox), flood_bar, FALSE, FALSE, 0);
 
     gtk_widget_show_all (window);
 
@@ -56,7 +111,16 @@ init_ui (GtkWidget *window)
     ui_struct->hbox  = hbox;
     ui_struct->btn   = btn;
     ui_struct->entry = entry;
+    ui_struct->hint  = hint;
     ui_struct->view  = view;
+    ui_struct->out   = outview_new (GTK_TEXT_VIEW (view));
+
+    ui_struct->search_bar  = search_bar;
+    ui_struct->flood_bar   = flood_bar;
+    ui_struct->flood_label = flood_label;
+    ui_struct->flood_tail  = flood_tail;
+    ui_struct->search      = search_new (ui_struct->out, search_entry,
+                                         search_label);
 
     //
 
@@ -2,6 +2,8 @@
 #define UI_H
 
 #include <gtk/gtk.h>
+#include "outview.h"
+#include "search.h"
 
 G_BEGIN_DECLS
 
@@ -13,7 +15,15 @@ struct _ui
               *hbox,
               *btn,
               *entry,
-              *view;
+              *hint,            /* Type of the expression being entered */
+              *view,
+              *search_bar,
+              *flood_bar,       /* Shown while output is spilled to disk */
+              *flood_label,
+              *flood_tail;
+
+    outview   *out;
+    search    *search;
 };
 
 ui *init_ui (GtkWidget *window);
@@ -0,0 +1,233 @@
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "utf8.h"
+#include "trace.h"
+
+/**
+ * Number of ASCII bytes at the start of p: sixteen at a time with SSE2,
+ * otherwise eight at a time.
+ */
+static gsize
+ascii_prefix (const guint8 *p,
+              gsize         len)
+{
+    gsize i = 0;
+
+#ifdef __SSE2__
+    for (; i + 16 <= len; i += 16) {
+        gint mask = _mm_movemask_epi8 (_mm_loadu_si128 ((const __m128i *)
+                                                        (p + i)));
+        if (mask) {
+            return i + g_bit_nth_lsf (mask, -1);
+        }
+    }
+#else
+    for (; i + 8 <= len; i += 8) {
+        guint64 word;
+
+        memcpy (&word, p + i, sizeof (word));
+        if (word & G_GUINT64_CONSTANT (0x8080808080808080)) {
+            break;
+        }
+    }
+#endif
+
+    while (i < len && p[i] < 0x80) {
+        ++i;
+    }
+    return i;
+}
+
+/**
+ * Check the sequence starting at p, of which avail bytes are at hand.
+ * Returns its length if it is valid, 0 if it is cut short but valid so
+ * far, or minus the length of its longest valid prefix (at least one byte),
+ * which is to be replaced by a single U+FFFD.
+ */
+static gint
+sequence (const guint8 *p,
+          gsize         avail)
+{
+    guint8 c  = p[0],
+           lo = 0x80,
+           hi = 0xbf;
+    gint   n,
+           i;
+
+    /* Ranges from the Unicode standard, table 3-7: no overlong forms, no
+     * surrogates, nothing past U+10FFFF */
+    if (c < 0x80) {
+        return 1;
+    } else if (c >= 0xc2 && c <= 0xdf) {
+        n = 2;
+    } else if (c >= 0xe0 && c <= 0xef) {
+        n = 3;
+        if (0xe0 == c) {
+            lo = 0xa0;
+        } else if (0xed == c) {
+            hi = 0x9f;
+        }
+    } else if (c >= 0xf0 && c <= 0xf4) {
+        n = 4;
+        if (0xf0 == c) {
+            lo = 0x90;
+        } else if (0xf4 == c) {
+            hi = 0x8f;
+        }
+    } else {
+        return -1;
+    }
+
+    for (i = 1; i < n; ++i) {
+        if ((gsize) i >= avail) {
+            return 0;
+        }
+        if (p[i] < lo || p[i] > hi) {
+            return -i;
+        }
+        lo = 0x80;
+        hi = 0xbf;
+    }
+    return n;
+}
+
+void
+utf8_stream_init (utf8_stream *u)
+{
+    u->clen     = 0;
+    u->replaced = 0;
+}
+
+/**
+ * Complete the sequence carried over from the last chunk. Returns the
+ * number of bytes of data used.
+ */
+static gsize
+take_carry (utf8_stream  *u,
+            const guint8 *data,
+            gsize         len,
+            GString      *out)
+{
+    guint8 buf[8];
+    gsize  used = 0,
+           take;
+    gint   r;
+
+    while (u->clen) {
+        take = MIN (sizeof (u->carry), len - used);
+        memcpy (buf, u->carry, u->clen);
+        memcpy (buf + u->clen, data + used, take);
+
+        r = sequence (buf, u->clen + take);
+        if (!r) {
+            /* Still not complete, so all of data was taken */
+            memcpy (u->carry + u->clen, data + used, take);
+            u->clen += take;
+            return len;
+        }
+        if (r > 0) {
+            g_string_append_len (out, (const gchar *) buf, r);
+            used   += r - u->clen;
+            u->clen = 0;
+            break;
+        }
+
+        g_string_append (out, UTF8_REPLACEMENT);
+        ++u->replaced;
+        if ((guint) -r >= u->clen) {
+            used   += -r - u->clen;
+            u->clen = 0;
+        } else {
+            /* Look at the rest of the carry again */
+            memmove (u->carry, u->carry - r, u->clen + r);
+            u->clen += r;
+        }
+    }
+    return used;
+}
+
+/**
+ * Pass a chunk through the validator. Returns the valid UTF-8 text that
+ * can be shown now, *out_len bytes of it: data itself when it needs no
+ * changes, which is the usual case, otherwise a copy made in scratch with
+ * invalid bytes replaced by U+FFFD. A sequence cut at the end of data is
+ * held back.
+ */
+const gchar *
+utf8_stream_feed (utf8_stream   *u,
+                  const guint8  *data,
+                  gsize          len,
+                  GString       *scratch,
+                  gsize         *out_len)
+{
+    const guint8 *p   = data,
+                 *end = data + len,
+                 *run;
+    gint          r;
+
+    g_string_truncate (scratch, 0);
+
+    if (u->clen) {
+        p += take_carry (u, data, len, scratch);
+    }
+
+    for (run = p; p < end; ) {
+        p += ascii_prefix (p, end - p);
+        if (p == end) {
+            break;
+        }
+
+        r = sequence (p, end - p);
+        if (r > 0) {
+            p += r;
+            continue;
+        }
+
+        g_string_append_len (scratch, (const gchar *) run, p - run);
+        if (!r) {
+            /* Wait for the rest */
+            u->clen = end - p;
+            memcpy (u->carry, p, u->clen);
+            run = p = end;
+            break;
+        }
+
+        g_string_append (scratch, UTF8_REPLACEMENT);
+        ++u->replaced;
+        TRACE_COUNTER ("utf8.replaced", u->replaced);
+        run = p += -r;
+    }
+
+    if (run == data && !scratch->len) {
+        *out_len = len;
+        return (const gchar *) data;
+    }
+
+    g_string_append_len (scratch, (const gchar *) run, end - run);
+    *out_len = scratch->len;
+    return scratch->str;
+}
+
+/**
+ * The stream has ended, or paused at a prompt: a sequence still waiting for
+ * its last bytes will not get them. Returns what to show in its place, if
+ * anything.
+ */
+const gchar *
+utf8_stream_finish (utf8_stream *u,
+                    GString     *scratch,
+                    gsize       *out_len)
+{
+    g_string_truncate (scratch, 0);
+
+    if (u->clen) {
+        g_string_append (scratch, UTF8_REPLACEMENT);
+        ++u->replaced;
+        u->clen = 0;
+    }
+
+    *out_len = scratch->len;
+    return scratch->str;
+}
@@ -0,0 +1,29 @@
+#ifndef UTF8_H
+#define UTF8_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+#define UTF8_REPLACEMENT "\xef\xbf\xbd"    /* U+FFFD */
+
+typedef struct _utf8_stream utf8_stream;
+
+/* Validates a byte stream that arrives in arbitrary chunks. A sequence cut
+ * at the end of a chunk is held back until the next one completes it. */
+struct _utf8_stream
+{
+    guint8   carry[4];          /* Start of a sequence cut by the chunk end */
+    guint8   clen;
+    guint64  replaced;          /* Invalid sequences seen */
+};
+
+void         utf8_stream_init   (utf8_stream *u);
+const gchar *utf8_stream_feed   (utf8_stream *u, const guint8 *data,
+                                 gsize len, GString *scratch, gsize *out_len);
+const gchar *utf8_stream_finish (utf8_stream *u, GString *scratch,
+                                 gsize *out_len);
+
+G_END_DECLS
+
+#endif /* UTF8_H */
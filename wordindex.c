@@ -0,0 +1,760 @@
+#include <string.h>
+#include <glib/gstdio.h>
+#include "wordindex.h"
+#include "trace.h"
+
+struct _word_index
+{
+    GMappedFile   *file;
+    const guint32 *offsets;
+    const gchar   *blob;
+    guint32        count;
+    guint64        blob_size;
+};
+
+static guint32
+read_le32 (const gchar *p)
+{
+    guint32 v;
+
+    memcpy (&v, p, sizeof (v));
+    return GUINT32_FROM_LE (v);
+}
+
+static guint64
+read_le64 (const gchar *p)
+{
+    guint64 v;
+
+    memcpy (&v, p, sizeof (v));
+    return GUINT64_FROM_LE (v);
+}
+
+/**
+ * Map an index file. Only the header is checked; the names are paged in
+ * as lookups touch them.
+ */
+word_index *
+word_index_open (const gchar  *path,
+                 GError      **error)
+{
+    GMappedFile *file;
+    word_index  *idx;
+    const gchar *data;
+    gsize        size;
+    guint32      count;
+    guint64      blob_size;
+
+    file = g_mapped_file_new (path, FALSE, error);
+    if (!file) {
+        return NULL;
+    }
+
+    data = g_mapped_file_get_contents (file);
+    size = g_mapped_file_get_length (file);
+
+    if (size < WORD_INDEX_HEADER
+            || memcmp (data, WORD_INDEX_MAGIC, 8)) {
+        goto invalid;
+    }
+
+    count     = read_le32 (data + 8);
+    blob_size = read_le64 (data + 16);
+
+    if ((guint64) size != WORD_INDEX_HEADER + 4 * (guint64) count + blob_size
+            || !blob_size || data[size - 1]) {
+        goto invalid;
+    }
+
+    idx            = g_malloc0 (sizeof (word_index));
+    idx->file      = file;
+    idx->offsets   = (const guint32 *) (data + WORD_INDEX_HEADER);
+    idx->blob      = data + WORD_INDEX_HEADER + 4 * (gsize) count;
+    idx->count     = count;
+    idx->blob_size = blob_size;
+
+    return idx;
+
+invalid:
+    g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+                 "%s: Not a completion index", path);
+    g_mapped_file_unref (file);
+    return NULL;
+}
+
+guint
+word_index_count (word_index *idx)
+{
+    return idx->count;
+}
+
+const gchar *
+word_index_get (word_index *idx,
+                guint       i)
+{
+    guint32 offset = GUINT32_FROM_LE (idx->offsets[i]);
+
+    /* The blob ends in a NUL, so any offset inside it is a string */
+    return offset < idx->blob_size ? idx->blob + offset : "";
+}
+
+/**
+ * Find the names starting with prefix: [*first, *last). Returns FALSE if
+ * there are none.
+ */
+gboolean
+word_index_range (word_index   *idx,
+                  const gchar  *prefix,
+                  guint        *first,
+                  guint        *last)
+{
+    gsize len = strlen (prefix);
+    guint lo  = 0,
+          hi  = idx->count,
+          mid;
+
+    /* First name not less than prefix */
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (strcmp (word_index_get (idx, mid), prefix) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    *first = lo;
+
+    /* First name past the ones starting with prefix */
+    hi = idx->count;
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (strncmp (word_index_get (idx, mid), prefix, len) <= 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    *last = lo;
+
+    return *first < *last;
+}
+
+void
+word_index_free (word_index *idx)
+{
+    g_mapped_file_unref (idx->file);
+    g_free (idx);
+}
+
+static gint
+compare_words (gconstpointer a,
+               gconstpointer b)
+{
+    return strcmp (*(const gchar * const *) a, *(const gchar * const *) b);
+}
+
+/**
+ * Write words (sorted in place, duplicates dropped) as an index file. The
+ * file is replaced atomically, so that readers never map half of it.
+ */
+gboolean
+word_index_write (const gchar  *path,
+                  GPtrArray    *words,
+                  GError      **error)
+{
+    GString     *out;
+    GArray      *offsets;
+    GString     *blob;
+    const gchar *prev = NULL;
+    guint32      v32;
+    guint64      v64;
+    guint        i;
+    gboolean     ok;
+
+    g_ptr_array_sort (words, compare_words);
+
+    offsets = g_array_new (FALSE, FALSE, sizeof (guint32));
+    blob    = g_string_new (NULL);
+
+    for (i = 0; i < words->len; ++i) {
+        const gchar *w = g_ptr_array_index (words, i);
+
+        if (prev && !strcmp (prev, w)) {
+            continue;
+        }
+        v32 = GUINT32_TO_LE (blob->len);
+        g_array_append_val (offsets, v32);
+        g_string_append_len (blob, w, strlen (w) + 1);
+        prev = w;
+    }
+    if (!blob->len) {
+        g_string_append_c (blob, '\0');
+    }
+
+    out = g_string_sized_new (WORD_INDEX_HEADER + 4 * offsets->len
+                              + blob->len);
+    g_string_append_len (out, WORD_INDEX_MAGIC, 8);
+    v32 = GUINT32_TO_LE (offsets->len);
+    g_string_append_len (out, (const gchar *) &v32, 4);
+    v32 = 0;
+    g_string_append_len (out, (const gchar *) &v32, 4);
+    v64 = GUINT64_TO_LE (blob->len);
+    g_string_append_len (out, (const gchar *) &v64, 8);
+    g_string_append_len (out, offsets->data, 4 * offsets->len);
+    g_string_append_len (out, blob->str, blob->len);
+
+    ok = g_file_set_contents (path, out->str, out->len, error);
+
+    g_string_free (out, TRUE);
+    g_string_free (blob, TRUE);
+    g_array_free (offsets, TRUE);
+
+    return ok;
+}
+
+/**
+ * Run a short command and return its standard output, or NULL.
+ */
+static gchar *
+capture (gchar **argv)
+{
+    gchar *out = NULL;
+    gint   status;
+
+    if (!g_spawn_sync (NULL, argv, NULL,
+                       G_SPAWN_SEARCH_PATH | G_SPAWN_STDERR_TO_DEV_NULL,
+                       NULL, NULL, &out, NULL, &status, NULL)
+            || !g_spawn_check_exit_status (status, NULL)) {
+        g_free (out);
+        return NULL;
+    }
+    return out;
+}
+
+/**
+ * ghc itself, with its -B flag, from the ghci command line.
+ */
+static GPtrArray *
+ghc_command (gchar **argv)
+{
+    GPtrArray *cmd = g_ptr_array_new ();
+    guint      i;
+
+    g_ptr_array_add (cmd, argv[0]);
+    for (i = 1; argv[i]; ++i) {
+        if (g_str_has_prefix (argv[i], "-B")) {
+            g_ptr_array_add (cmd, argv[i]);
+        }
+    }
+    return cmd;
+}
+
+/**
+ * ghc-pkg of the installation that argv launches: next to the ghc binary,
+ * or in the bin directory of its libdir. Either way it is pointed at that
+ * libdir's global package database, so that even a ghc-pkg found in PATH
+ * reports the packages this ghc sees. NULL if ghc cannot tell its libdir.
+ */
+static GPtrArray *
+ghc_pkg_command (gchar **argv)
+{
+    GPtrArray *cmd = ghc_command (argv);
+    gchar     *libdir,
+              *dir,
+              *db,
+              *pkg;
+
+    g_ptr_array_add (cmd, "--print-libdir");
+    g_ptr_array_add (cmd, NULL);
+    libdir = capture ((gchar **) cmd->pdata);
+    g_ptr_array_free (cmd, TRUE);
+
+    if (!libdir) {
+        return NULL;
+    }
+    g_strstrip (libdir);
+
+    dir = g_path_get_dirname (argv[0]);
+    pkg = g_build_filename (dir, "ghc-pkg", NULL);
+    if (!g_file_test (pkg, G_FILE_TEST_IS_EXECUTABLE)) {
+        g_free (pkg);
+        pkg = g_build_filename (libdir, "bin", "ghc-pkg", NULL);
+    }
+    if (!g_file_test (pkg, G_FILE_TEST_IS_EXECUTABLE)) {
+        g_free (pkg);
+        pkg = g_strdup ("ghc-pkg");
+    }
+
+    db  = g_build_filename (libdir, "package.conf.d", NULL);
+    cmd = g_ptr_array_new_with_free_func (g_free);
+    g_ptr_array_add (cmd, pkg);
+    g_ptr_array_add (cmd, g_strconcat ("--global-package-db=", db, NULL));
+
+    g_free (db);
+    g_free (dir);
+    g_free (libdir);
+
+    return cmd;
+}
+
+/**
+ * Run ghc-pkg with args and return its standard output, or NULL.
+ */
+static gchar *
+capture_pkg (GPtrArray    *pkg,
+             const gchar **args)
+{
+    GPtrArray *cmd;
+    gchar     *out;
+    guint      i;
+
+    if (!pkg) {
+        return NULL;
+    }
+
+    cmd = g_ptr_array_new ();
+    for (i = 0; i < pkg->len; ++i) {
+        g_ptr_array_add (cmd, g_ptr_array_index (pkg, i));
+    }
+    for (i = 0; args[i]; ++i) {
+        g_ptr_array_add (cmd, (gpointer) args[i]);
+    }
+    g_ptr_array_add (cmd, NULL);
+
+    out = capture ((gchar **) cmd->pdata);
+    g_ptr_array_free (cmd, TRUE);
+
+    return out;
+}
+
+/**
+ * Index file for the installed GHC version and package set, under the
+ * user's cache directory.
+ */
+static gchar *
+index_path (gchar     **argv,
+            GPtrArray  *pkg)
+{
+    GPtrArray   *cmd = ghc_command (argv);
+    const gchar *pkg_args[] = { "list", "--simple-output", NULL };
+    gchar       *version,
+                *packages,
+                *key,
+                *name,
+                *dir,
+                *path;
+
+    g_ptr_array_add (cmd, "--numeric-version");
+    g_ptr_array_add (cmd, NULL);
+    version = capture ((gchar **) cmd->pdata);
+    g_ptr_array_free (cmd, TRUE);
+
+    if (!version) {
+        return NULL;
+    }
+    g_strstrip (version);
+
+    packages = capture_pkg (pkg, pkg_args);
+    key      = g_compute_checksum_for_string (G_CHECKSUM_SHA1,
+                                              packages ? packages : "", -1);
+
+    dir  = g_build_filename (g_get_user_cache_dir (), "gtk-ghci", NULL);
+    g_mkdir_with_parents (dir, 0700);
+    name = g_strdup_printf ("names-%s-%.16s.idx", version, key);
+    path = g_build_filename (dir, name, NULL);
+
+    g_free (name);
+    g_free (dir);
+    g_free (key);
+    g_free (packages);
+    g_free (version);
+
+    return path;
+}
+
+static gboolean
+is_module_name (const gchar *s)
+{
+    if (!g_ascii_isupper (*s)) {
+        return FALSE;
+    }
+    for (; *s; ++s) {
+        if (!g_ascii_isalnum (*s) && '_' != *s && '\'' != *s && '.' != *s) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+static void
+add_name (GPtrArray    *words,
+          const gchar  *start,
+          const gchar  *end)
+{
+    const gchar *p;
+
+    while (start < end && ' ' == *start) {
+        ++start;
+    }
+    while (end > start && ' ' == end[-1]) {
+        --end;
+    }
+
+    /* Drop a module qualifier */
+    for (p = end; p > start; --p) {
+        if ('.' == p[-1] && p < end && g_ascii_isalpha (*p)) {
+            start = p;
+            break;
+        }
+    }
+
+    if (start < end && (g_ascii_isalpha (*start) || '_' == *start)) {
+        g_ptr_array_add (words, g_strndup (start, end - start));
+    }
+}
+
+/**
+ * A constructor: the first name of one alternative of a data declaration,
+ * after any forall and context.
+ */
+static void
+add_constructor (GPtrArray   *words,
+                 const gchar *start,
+                 const gchar *end)
+{
+    const gchar *p,
+                *brace = memchr (start, '{', end - start);
+
+    while (start < end && ' ' == *start) {
+        ++start;
+    }
+    if (g_str_has_prefix (start, "forall ")
+            && (p = memchr (start, '.', end - start))) {
+        start = p + 1;
+    }
+    if ((p = g_strstr_len (start, (brace ? brace : end) - start, "=>"))) {
+        start = p + 2;
+    }
+    while (start < end && ' ' == *start) {
+        ++start;
+    }
+
+    if (start < end && g_ascii_isupper (*start)) {
+        for (p = start; p < end && (g_ascii_isalnum (*p) || '_' == *p
+                                    || '\'' == *p || '.' == *p); ++p) {
+        }
+        add_name (words, start, p);
+    }
+}
+
+/**
+ * A record field: the name in front of its type.
+ */
+static void
+add_field (GPtrArray   *words,
+           const gchar *start,
+           const gchar *end)
+{
+    const gchar *sig = g_strstr_len (start, end - start, "::");
+
+    add_name (words, start, sig ? sig : end);
+}
+
+/**
+ * The constructors and record fields of the alternatives in p, the part
+ * of a data declaration after its = or |.
+ */
+static void
+add_constructors (GPtrArray   *words,
+                  const gchar *p)
+{
+    const gchar *alt   = p,
+                *field = NULL;
+    gint         depth = 0;
+
+    for (; ; ++p) {
+        if (!*p || (!depth && '|' == *p)) {
+            add_constructor (words, alt, p);
+            if (!*p) {
+                break;
+            }
+            alt = p + 1;
+            continue;
+        }
+
+        switch (*p) {
+        case '{':
+            if (!depth) {
+                field = p + 1;
+            }
+            ++depth;
+            break;
+        case '(':
+        case '[':
+            ++depth;
+            break;
+        case ')':
+        case ']':
+            --depth;
+            break;
+        case '}':
+            if (1 == depth && field) {
+                add_field (words, field, p);
+                field = NULL;
+            }
+            --depth;
+            break;
+        case ',':
+            if (1 == depth && field) {
+                add_field (words, field, p);
+                field = p + 1;
+            }
+            break;
+        }
+    }
+}
+
+/**
+ * The throwaway ghci prints its first prompt, "Prelude> " or the like,
+ * before the prompt is set to nothing: in front of the first output.
+ */
+static const gchar *
+skip_prompt (const gchar *line)
+{
+    const gchar *p;
+
+    for (p = line; g_ascii_isalnum (*p) || (*p && strchr ("_.'* ", *p));
+         ++p) {
+    }
+    if (p > line && '>' == p[0] && ' ' == p[1]) {
+        return p + 2;
+    }
+    return line;
+}
+
+/**
+ * Pick the names out of :browse output: the left-hand side of type
+ * signatures, the names of types and classes, and the constructors and
+ * fields of data types, which ghci may break over several lines.
+ */
+void
+word_index_parse (const gchar *text,
+                  GPtrArray   *words)
+{
+    static const gchar *keywords[] = {
+        "data family ", "type family ", "data ", "newtype ", "type ",
+        "class ", NULL
+    };
+    gchar      **lines  = g_strsplit (text, "\n", -1);
+    const gchar *p,
+                *sig,
+                *comma,
+                *end;
+    gboolean     prompt = TRUE,
+                 data   = FALSE;
+    guint        i,
+                 k;
+
+    for (i = 0; lines[i]; ++i) {
+        p = prompt ? skip_prompt (lines[i]) : lines[i];
+        if (p != lines[i]) {
+            prompt = FALSE;
+        }
+        if (' ' != *p) {
+            data = FALSE;
+        }
+        while (' ' == *p) {
+            ++p;
+        }
+        if (!*p || g_str_has_prefix (p, "--")) {
+            continue;
+        }
+
+        if (data && ('=' == *p || '|' == *p) && ' ' == p[1]) {
+            add_constructors (words, p + 1);
+            continue;
+        }
+
+        for (k = 0; keywords[k]; ++k) {
+            if (g_str_has_prefix (p, keywords[k])) {
+                break;
+            }
+        }
+        if (keywords[k]) {
+            data = !strcmp (keywords[k], "data ")
+                   || !strcmp (keywords[k], "newtype ");
+            p   += strlen (keywords[k]);
+
+            /* The context of the type, not of a constructor */
+            end = strstr (p, " = ");
+            if ((sig = g_strstr_len (p, end ? end - p : -1, "=>"))) {
+                p = sig + 2;
+            }
+            while (' ' == *p) {
+                ++p;
+            }
+            for (end = p; g_ascii_isalnum (*end) || '_' == *end
+                          || '\'' == *end || '.' == *end; ++end) {
+            }
+            add_name (words, p, end);
+
+            if (data && (end = strstr (end, " = "))) {
+                add_constructors (words, end + 3);
+            }
+            continue;
+        }
+
+        sig = strstr (p, " :: ");
+        if (!sig) {
+            continue;
+        }
+        while ((comma = memchr (p, ',', sig - p))) {
+            add_name (words, p, comma);
+            p = comma + 1;
+        }
+        add_name (words, p, sig);
+    }
+
+    g_strfreev (lines);
+}
+
+/**
+ * Build the index by :browse-ing every exposed module of the installed
+ * packages in a throwaway ghci.
+ */
+static gboolean
+build_index (gchar        **argv,
+             GPtrArray     *pkg,
+             const gchar   *path,
+             GError       **error)
+{
+    const gchar *field_args[] = { "field", "*", "exposed-modules",
+                                  "--simple-output", NULL };
+    gchar       *modules,
+               **tokens;
+    GString     *script;
+    GSubprocess *ghci;
+    GBytes      *in,
+                *out = NULL;
+    GPtrArray   *words;
+    gboolean     ok;
+    guint        i;
+
+    TRACE_BEGIN ("word_index.build");
+
+    modules = capture_pkg (pkg, field_args);
+    script  = g_string_new (":set prompt \"\"\n:browse Prelude\n");
+    tokens  = g_strsplit_set (modules ? modules : "", " \t\r\n,", -1);
+    for (i = 0; tokens[i]; ++i) {
+        if (is_module_name (tokens[i])) {
+            g_string_append_printf (script, ":browse %s\n", tokens[i]);
+        }
+    }
+    g_string_append (script, ":quit\n");
+    g_strfreev (tokens);
+    g_free (modules);
+
+    ghci = g_subprocess_newv ((const gchar * const *) argv, error,
+                              G_SUBPROCESS_FLAGS_STDIN_PIPE
+                              | G_SUBPROCESS_FLAGS_STDOUT_PIPE
+                              | G_SUBPROCESS_FLAGS_STDERR_SILENCE);
+    if (!ghci) {
+        g_string_free (script, TRUE);
+        TRACE_END ("word_index.build");
+        return FALSE;
+    }
+
+    in = g_string_free_to_bytes (script);
+    ok = g_subprocess_communicate (ghci, in, NULL, &out, NULL, error);
+    g_bytes_unref (in);
+    g_object_unref (ghci);
+
+    if (ok) {
+        gchar *text = g_strndup (g_bytes_get_data (out, NULL),
+                                 g_bytes_get_size (out));
+
+        words = g_ptr_array_new_with_free_func (g_free);
+        word_index_parse (text, words);
+        ok = word_index_write (path, words, error);
+
+        g_ptr_array_free (words, TRUE);
+        g_free (text);
+    }
+    if (out) {
+        g_bytes_unref (out);
+    }
+
+    TRACE_END ("word_index.build");
+    return ok;
+}
+
+static void
+load_thread (GTask                      *task,
+             gpointer     G_GNUC_UNUSED  source,
+             gchar                     **argv,
+             GCancellable G_GNUC_UNUSED *cancellable)
+{
+    GError     *error = NULL;
+    word_index *idx;
+    GPtrArray  *pkg;
+    gchar      *path;
+    gint64      start = g_get_monotonic_time ();
+
+    pkg  = ghc_pkg_command (argv);
+    path = index_path (argv, pkg);
+    if (!path) {
+        g_task_return_new_error (task, G_SPAWN_ERROR, G_SPAWN_ERROR_FAILED,
+                                 "Cannot determine the GHC version");
+        if (pkg) {
+            g_ptr_array_free (pkg, TRUE);
+        }
+        return;
+    }
+
+    idx = word_index_open (path, NULL);
+    if (!idx) {
+        g_message ("Building completion index %s", path);
+
+        if (build_index (argv, pkg, path, &error)) {
+            idx = word_index_open (path, &error);
+        }
+    }
+
+    if (idx) {
+        g_message ("Completion index: %u names in %.1f ms",
+                   word_index_count (idx),
+                   (g_get_monotonic_time () - start) / 1000.0);
+        g_task_return_pointer (task, idx, (GDestroyNotify) word_index_free);
+    } else {
+        g_task_return_error (task, error);
+    }
+    if (pkg) {
+        g_ptr_array_free (pkg, TRUE);
+    }
+    g_free (path);
+}
+
+/**
+ * Map the completion index for the GHC that argv launches, building it
+ * first if this GHC version and package set has none yet. Everything,
+ * including asking ghc and its ghc-pkg for the key, happens in a worker
+ * thread.
+ */
+void
+word_index_load_async (gchar               **argv,
+                       GAsyncReadyCallback   callback,
+                       gpointer              data)
+{
+    GTask *task = g_task_new (NULL, NULL, callback, data);
+
+    g_task_set_task_data (task, g_strdupv (argv), (GDestroyNotify) g_strfreev);
+    g_task_run_in_thread (task, (GTaskThreadFunc) load_thread);
+    g_object_unref (task);
+}
+
+word_index *
+word_index_load_finish (GAsyncResult  *result,
+                        GError       **error)
+{
+    return g_task_propagate_pointer (G_TASK (result), error);
+}
@@ -0,0 +1,38 @@
+#ifndef WORDINDEX_H
+#define WORDINDEX_H
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+/* On-disk layout, all integers little-endian:
+ *
+ *   header      magic, name count, reserved, size of the name blob
+ *   offsets     guint32 per name, into the blob, in strcmp order
+ *   blob        NUL-terminated names
+ *
+ * Nothing in the file is a pointer, so it is used in place once mapped. */
+#define WORD_INDEX_MAGIC    "GGHCIDX1"
+#define WORD_INDEX_HEADER   24
+
+typedef struct _word_index word_index;
+
+word_index  *word_index_open        (const gchar *path, GError **error);
+gboolean     word_index_write       (const gchar *path, GPtrArray *words,
+                                     GError **error);
+guint        word_index_count       (word_index *idx);
+const gchar *word_index_get         (word_index *idx, guint i);
+gboolean     word_index_range       (word_index *idx, const gchar *prefix,
+                                     guint *first, guint *last);
+void         word_index_free        (word_index *idx);
+
+void         word_index_parse       (const gchar *text, GPtrArray *words);
+
+void         word_index_load_async  (gchar **argv,
+                                     GAsyncReadyCallback callback,
+                                     gpointer data);
+word_index  *word_index_load_finish (GAsyncResult *result, GError **error);
+
+G_END_DECLS
+
+#endif /* WORDINDEX_H */